@@ -7,9 +7,11 @@
 #include "Debug.h"
 #include "GameProxy.h"
 #include "Map.h"
+#include "MapCache.h"
 #include "RayCaster.h"
 #include "RegionRegistry.h"
 #include "Shooter.h"
+#include "TaskGraph.h"
 #include "platform/ContinuumGameProxy.h"
 #include "platform/Platform.h"
 
@@ -24,6 +26,9 @@
 
 namespace marvin {
 
+// The bot ticks at about 60 Hz, so searches for CreatePath are spread across frames once they take longer than this.
+constexpr u64 kPathSearchBudgetMicroseconds = 2000;
+
 class DefaultBehaviorBuilder : public BehaviorBuilder {
  public:
   void CreateBehavior(Bot& bot) {
@@ -100,32 +105,75 @@ std::unique_ptr<BehaviorBuilder> CreateBehaviorBuilder(Zone zone, std::string na
   return builder;
 }
 
-Bot::Bot(std::shared_ptr<marvin::GameProxy> game) : game_(std::move(game)), time_(*game_) {
+Bot::Bot(std::shared_ptr<marvin::GameProxy> game)
+    : game_(std::move(game)), workers_(std::make_unique<WorkerPool>()), time_(*game_) {
   LoadBot();
 }
 
 void Bot::LoadBot() {
+  PerformanceTimer load_timer;
   srand((unsigned int)time_.GetTime());
   radius_ = game_->GetShipSettings().GetRadius();
 
-  auto processor = std::make_unique<path::NodeProcessor>(*game_);
-  marvin::debug_log << "proccessor created" << std::endl;
-  
+  const Map& map = game_->GetMap();
+
   influence_map_ = std::make_unique<InfluenceMap>();
-  regions_ = std::make_unique<RegionRegistry>(game_->GetMap());
-  regions_->CreateAll(game_->GetMap(), radius_);
-  
-  pathfinder_ = std::make_unique<path::Pathfinder>(std::move(processor), *regions_);
-  marvin::debug_log << "pathfinder created" << std::endl;
-  pathfinder_->CreateMapWeights(game_->GetMap());
-  pathfinder_->SetPathableNodes(game_->GetMap(), radius_);
+  map_cache_ = std::make_unique<MapCache>(map, radius_);
+
+  CreateMapData();
+
+  MapCacheLoad load = map_cache_->Load(map, *regions_, *pathfinder_);
+  bool cached = load == MapCacheLoad::Loaded;
+
+  if (cached) {
+    marvin::debug_log << "map data loaded from cache in " << load_timer.GetElapsedTime() << "us" << std::endl;
+  } else {
+    // A file that failed to load part way through can leave data behind, so start over with empty data.
+    if (load == MapCacheLoad::Corrupt) {
+      CreateMapData();
+    }
+
+    // The regions and the pathfinder data only depend on the map, so they are built at the same time. The map
+    // clearance is built when the map is loaded.
+    // Setting the weights and the pathable nodes both rebuild the jump masks, so they need to run one after the other.
+    TaskGraph graph;
+
+    graph.Add("regions", [this, &map]() { regions_->CreateAll(map, radius_); });
+    TaskId weights = graph.Add("weights", [this, &map]() { pathfinder_->CreateMapWeights(map); });
+    TaskId pathable = graph.Add("pathable", [this, &map]() { pathfinder_->SetPathableNodes(map, radius_); }, {weights});
+    graph.Add("clusters", [this, &map]() { pathfinder_->CreateClusters(map); }, {pathable});
+
+    graph.Run(*workers_);
+
+    for (const TaskGraph::Task& task : graph.GetTasks()) {
+      marvin::debug_log << task.name << " created in " << task.elapsed << "us" << std::endl;
+    }
+  }
+
+  marvin::debug_log << "map preprocessed in " << load_timer.GetElapsedTime() << "us" << std::endl;
+  pathfinder_->SetSearchBudget(path::SearchBudget(0, kPathSearchBudgetMicroseconds));
   Zone zone = game_->GetZone();
   marvin::debug_log << "Zone " << game_->GetMapFile() << " found" << std::endl;
   auto builder = CreateBehaviorBuilder(zone, game_->GetPlayer().name);
 
   ctx_.bot = this;
 
+  // The builders create the base paths, so this waits until the regions and the pathfinder data are done.
   this->behavior_ = builder->Build(*this);
+  marvin::debug_log << "behavior and base paths created in " << load_timer.GetElapsedTime() << "us" << std::endl;
+
+  if (!cached || map_cache_->IsDirty()) {
+    if (map_cache_->Save(*regions_, *pathfinder_)) {
+      marvin::debug_log << "map cache saved in " << load_timer.GetElapsedTime() << "us" << std::endl;
+    }
+  }
+}
+
+void Bot::CreateMapData() {
+  regions_ = std::make_unique<RegionRegistry>(game_->GetMap());
+  pathfinder_ = std::make_unique<path::Pathfinder>(std::make_unique<path::NodeProcessor>(*game_), *regions_);
+  regions_->SetWorkerPool(workers_.get());
+  pathfinder_->SetWorkerPool(workers_.get());
 }
 
 void Bot::Update(float dt) {
@@ -144,6 +192,9 @@ void Bot::Update(float dt) {
 
   g_RenderState.RenderDebugText("GameUpdate: %llu", timer.GetElapsedTime());
 
+  regions_->CollectRebuild();
+  pathfinder_->CollectClusters();
+
   steering_.Reset();
 
   ctx_.dt = dt;
@@ -179,6 +230,9 @@ void Bot::Update(float dt) {
 
   if (radius_ != radius && ship != 8) {
     pathfinder_->SetPathableNodes(game_->GetMap(), radius);
+    // The cluster graph takes far longer than a frame to build, so it's built on the workers. Hierarchical searches
+    // use A* until it's swapped in.
+    pathfinder_->StartClusterBuild(game_->GetMap());
     radius_ = radius;
     g_RenderState.RenderDebugText("SetPathableNodes: %llu", timer.GetElapsedTime());
   }
@@ -222,18 +276,90 @@ void Bot::Move(const Vector2f& target, float target_distance) {
   }
 }
 
+void Bot::CreateBasePathLengths() {
+  for (std::size_t i = base_path_lengths_.size(); i < base_paths_.size(); ++i) {
+    base_path_lengths_.push_back(path::PathNodeSearch::CreateArcLengths(base_paths_[i]));
+  }
+
+  // The paths may have moved, so the search needs to bind again.
+  base_search_index_ = kNoBaseIndex;
+}
+
+void Bot::SetTileId(Vector2f position, u8 id) {
+  SetTileIds({std::make_pair(MapCoord(position), id)});
+}
+
+void Bot::SetTileIds(const std::vector<std::pair<MapCoord, u8>>& tiles) {
+  const Map& map = game_->GetMap();
+  std::vector<MapCoord> changed;
+
+  for (const auto& tile : tiles) {
+    MapCoord coord = tile.first;
+
+    if (!IsValidPosition(coord)) continue;
+
+    bool solid = map.IsSolid(coord.x, coord.y);
+
+    game_->SetTileId(Vector2f(coord.x, coord.y), tile.second);
+
+    // Doors and other tiles that are open either way don't change anything that was built from the map.
+    if (map.IsSolid(coord.x, coord.y) == solid) continue;
+
+    // Each region update works from the regions that the one before it left.
+    regions_->UpdateTile(map, coord, radius_);
+    changed.push_back(coord);
+  }
+
+  if (changed.empty()) return;
+
+  pathfinder_->UpdateTiles(map, changed, radius_);
+
+  // The base path search keeps results that were found through the old tiles.
+  if (base_search_) {
+    base_search_->ClearMapData();
+  }
+}
+
+path::PathNodeSearch& Bot::GetBasePathSearch(std::size_t search_range) {
+  std::size_t base_index = ctx_.blackboard.ValueOr<std::size_t>("BaseIndex", 0);
+
+  if (!base_search_) {
+    base_search_ = path::PathNodeSearch::Create(*this, search_range);
+  }
+
+  if (base_index != base_search_index_) {
+    base_search_->SetPath(base_paths_[base_index], base_path_lengths_[base_index]);
+    base_search_index_ = base_index;
+  }
+
+  base_search_->SetSearchRange(search_range);
+
+  // The corridor is built once for each base with the largest range that has been asked for.
+  if (search_range > base_search_->GetCorridorRange()) {
+    base_search_->BuildCorridor();
+  }
+
+  return *base_search_;
+}
+
 void Bot::CreateBasePaths(const std::vector<Vector2f>& start_vector, const std::vector<Vector2f>& end_vector,
                           float radius) {
   PerformanceTimer timer;
 
-  for (std::size_t i = 0; i < start_vector.size(); i++) {
-    Vector2f position_1 = start_vector[i];
-    Vector2f position_2 = end_vector[i];
+  if (map_cache_ && map_cache_->FindBasePaths(start_vector, end_vector, radius, base_paths_)) {
+    CreateBasePathLengths();
+    g_RenderState.RenderDebugText("CreateBasePaths: %llu", timer.GetElapsedTime());
+    return;
+  }
 
-    Path base_path = GetPathfinder().FindPath(game_->GetMap(), std::vector<Vector2f>(), position_1, position_2, radius);
+  std::vector<Path> created_paths =
+      GetPathfinder().FindPaths(game_->GetMap(), start_vector, end_vector, radius, *workers_);
 
-    base_paths_.push_back(base_path);
+  base_paths_.insert(base_paths_.end(), created_paths.begin(), created_paths.end());
+  CreateBasePathLengths();
 
+  if (map_cache_) {
+    map_cache_->AddBasePaths(start_vector, end_vector, radius, created_paths);
   }
   
   g_RenderState.RenderDebugText("CreateBasePaths: %llu", timer.GetElapsedTime());
@@ -605,15 +731,13 @@ behavior::ExecuteResult FindEnemyInBaseNode::Execute(behavior::ExecuteContext& c
 
   bool in_center = bb.ValueOr<bool>("InCenter", false);
   bool anchoring = bb.ValueOr<bool>("IsAnchor", false);
-  Path base_path = ctx.bot->GetBasePath();
-
-  if (base_path.empty() || in_center) {
+  if (ctx.bot->GetBasePath().empty() || in_center) {
     g_RenderState.RenderDebugText("  FindEnemyInBaseNode(fail): %llu", timer.GetElapsedTime());
     return result;
   }
 
-  auto search = path::PathNodeSearch::Create(*ctx.bot, base_path, 100);
-  int bot_node = (int)search->FindNearestNodeBFS(game.GetPosition());
+  path::PathNodeSearch& search = ctx.bot->GetBasePathSearch(100);
+  int bot_node = (int)search.FindNearestNodeBFS(game.GetPosition());
 
   float max_net_player_bullet_travel = std::numeric_limits<float>::lowest();
   const Player* target = nullptr;
@@ -629,10 +753,10 @@ behavior::ExecuteResult FindEnemyInBaseNode::Execute(behavior::ExecuteContext& c
     float alive_time = (float)game.GetSettings().BulletAliveTime / 100.0f;
     float player_bullet_speed = game.GetSettings().ShipSettings[player.ship].BulletSpeed / 10.0f / 16.0f;
 
-    int player_node = (int)search->FindNearestNodeBFS(player.position);
+    int player_node = (int)search.FindNearestNodeBFS(player.position);
     bool high_side = bot_node < player_node;
 
-    Vector2f player_fore = search->FindForwardLOSNode(*ctx.bot, player.position, player_node, 0.8f, high_side);
+    Vector2f player_fore = search.FindForwardLOSNode(*ctx.bot, player.position, player_node, 0.8f, high_side);
     //RenderWorldBox(game.GetPosition(), player_fore, 0.5f);
     Vector2f player_to_bot = Normalize(player_fore - player.position);
     //RenderDirection(game.GetPosition(), player.position, player_to_bot, player_fore.Distance(player.position));
@@ -651,7 +775,7 @@ behavior::ExecuteResult FindEnemyInBaseNode::Execute(behavior::ExecuteContext& c
     // if the player is flying at full speed in the direction of the player_fore position, then it will reach its maximum bullet travel
     float player_bullet_travel = (player_speed + player_bullet_speed) * alive_time;
     // at its current speed, how long will it take to reach the bots position
-    float player_pathlength_to_bot = search->GetPathDistance(player_node, bot_node);
+    float player_pathlength_to_bot = search.GetPathDistance(player_node, bot_node);
     float net_player_bullet_travel = player_bullet_travel - player_pathlength_to_bot;
 
     if (net_player_bullet_travel > max_net_player_bullet_travel) {
@@ -689,7 +813,7 @@ behavior::ExecuteResult PathToEnemyNode::Execute(behavior::ExecuteContext& ctx)
 
   float radius = game.GetShipSettings().GetRadius();
 
-  ctx.bot->GetPathfinder().CreatePath(*ctx.bot, bot, enemy->position, radius);
+  ctx.bot->GetPathfinder().CreatePath(*ctx.bot, bot, enemy->position, radius, path::SearchMode::Incremental);
 
   g_RenderState.RenderDebugText("  PathToEnemyNode(success): %llu", timer.GetElapsedTime());
   return behavior::ExecuteResult::Success;
@@ -716,7 +840,8 @@ behavior::ExecuteResult PatrolNode::Execute(behavior::ExecuteContext& ctx) {
       to = nodes.at(index);
     }
 
-    ctx.bot->GetPathfinder().CreatePath(*ctx.bot, from, to, radius);
+    // Patrol nodes are spread across the whole center, so these are long searches that the cluster graph speeds up.
+    ctx.bot->GetPathfinder().CreatePath(*ctx.bot, from, to, radius, path::SearchMode::Hierarchical);
 
     g_RenderState.RenderDebugText("  PatrolNode(success): %llu", timer.GetElapsedTime());
     return behavior::ExecuteResult::Success;
@@ -745,17 +870,15 @@ behavior::ExecuteResult RusherBasePathNode::Execute(behavior::ExecuteContext& ct
   Vector2f position = game.GetPosition();
   float radius = game.GetShipSettings().GetRadius();
 
-  Path base_path = ctx.bot->GetBasePath();
-
   Vector2f desired_position;
 
-  auto search = path::PathNodeSearch::Create(*ctx.bot, base_path, 30);
+  path::PathNodeSearch& search = ctx.bot->GetBasePathSearch(30);
 
-  size_t bot_node = search->FindNearestNodeBFS(position);
-  size_t enemy_node = search->FindNearestNodeBFS(enemy->position);
+  size_t bot_node = search.FindNearestNodeBFS(position);
+  size_t enemy_node = search.FindNearestNodeBFS(enemy->position);
   bool high_side = bot_node > enemy_node;
 
-  desired_position = search->FindForwardLOSNode(*ctx.bot, position, bot_node, radius, high_side);
+  desired_position = search.FindForwardLOSNode(*ctx.bot, position, bot_node, radius, high_side);
 
   ctx.bot->GetPathfinder().CreatePath(*ctx.bot, position, desired_position, radius);
 
@@ -786,8 +909,7 @@ behavior::ExecuteResult AnchorBasePathNode::Execute(behavior::ExecuteContext& ct
   float thrust = game.GetThrust();
   enemy_radius_ = game.GetSettings().ShipSettings[enemy->ship].GetRadius();
 
-  base_path_ = ctx.bot->GetBasePath();
-  search_ = path::PathNodeSearch::Create(*ctx.bot, base_path_, 100);
+  search_ = &ctx.bot->GetBasePathSearch(100);
   bot_node_ = search_->FindNearestNodeBFS(position_);
   enemy_node_ = search_->FindNearestNodeBFS(enemy->position);
   team_safe_node_ = ctx.bot->GetTeamSafeIndex(game.GetPlayer().frequency);
@@ -880,7 +1002,7 @@ behavior::ExecuteResult AnchorBasePathNode::Execute(behavior::ExecuteContext& ct
   g_RenderState.RenderDebugText("  ENEMY TEAM THREAT: %f", enemy_team_threat_);
   RenderWorldBox(game.GetPosition(), enemy->position, 0.875f);
 
-  ctx.bot->GetPathfinder().CreatePath(*ctx.bot, position_, desired_position_, radius_);
+  ctx.bot->GetPathfinder().CreatePath(*ctx.bot, position_, desired_position_, radius_, path::SearchMode::Incremental);
 
   g_RenderState.RenderDebugText("  AnchorBasePathNode(success): %llu", timer.GetElapsedTime());
   return behavior::ExecuteResult::Success;
@@ -6,10 +6,12 @@
 #include "commands/CommandSystem.h"
 #include "InfluenceMap.h"
 #include "KeyController.h"
+#include "MapCache.h"
 #include "RayCaster.h"
 #include "RegionRegistry.h"
 #include "Steering.h"
 #include "Time.h"
+#include "WorkerPool.h"
 #include "behavior/BehaviorEngine.h"
 #include "common.h"
 #include "path/Pathfinder.h"
@@ -29,6 +31,11 @@ class Bot {
 
   void LoadBot();
   void Update(float dt);
+  // Changes a tile in the game's map. A tile that changed between solid and open only updates the regions and the
+  // pathfinder around it instead of building them again.
+  void SetTileId(Vector2f position, u8 id);
+  // Changes several tiles at once, so the pathfinder updates around all of them in one pass.
+  void SetTileIds(const std::vector<std::pair<MapCoord, u8>>& tiles);
 
   KeyController& GetKeys() { return keys_; }
   GameProxy& GetGame() { return *game_; }
@@ -41,6 +48,7 @@ class Bot {
   SteeringBehavior& GetSteering() { return steering_; }
   InfluenceMap& GetInfluenceMap() { return *influence_map_; }
   CommandSystem& GetCommandSystem() { return command_system_; }
+  WorkerPool& GetWorkers() { return *workers_; }
 
   const std::vector<Vector2f>& GetBasePath() {
      return base_paths_[ctx_.blackboard.ValueOr<std::size_t>("BaseIndex", 0)];
@@ -48,6 +56,9 @@ class Bot {
   const std::vector<std::vector<Vector2f>>& GetBasePaths() {
     return base_paths_;
   }
+  // The node search bound to the current base path. It's kept between ticks and only binds again when the base
+  // changes.
+  path::PathNodeSearch& GetBasePathSearch(std::size_t search_range);
   const std::size_t GetTeamSafeIndex(uint16_t freq) {
     uint16_t low_index_team = ctx_.blackboard.ValueOr<uint16_t>(BB::PubTeam0, 999);
     uint16_t high_index_team = ctx_.blackboard.ValueOr<uint16_t>(BB::PubTeam1, 999);
@@ -73,18 +84,28 @@ class Bot {
   void FindPowerBallGoal();
 
  private:
+  // Creates empty regions and pathfinder data for the current map.
+  void CreateMapData();
+  // Creates the arc lengths for the base paths that don't have them yet.
+  void CreateBasePathLengths();
 
   float radius_;
 
   std::vector<std::vector<Vector2f>> base_paths_;
+  std::vector<std::vector<float>> base_path_lengths_;
+  static constexpr std::size_t kNoBaseIndex = ~(std::size_t)0;
+  std::unique_ptr<path::PathNodeSearch> base_search_;
+  std::size_t base_search_index_ = kNoBaseIndex;
   std::vector<std::vector<Vector2f>> base_holes_;
   Vector2f powerball_goal_;
   Vector2f powerball_goal_path_;
   std::string powerball_arena_;
 
   std::shared_ptr<GameProxy> game_;
+  std::unique_ptr<WorkerPool> workers_;
   std::unique_ptr<path::Pathfinder> pathfinder_;
   std::unique_ptr<RegionRegistry> regions_;
+  std::unique_ptr<MapCache> map_cache_;
   behavior::ExecuteContext ctx_;
   SteeringBehavior steering_;
   std::unique_ptr<InfluenceMap> influence_map_;
@@ -188,9 +209,8 @@ class AnchorBasePathNode : public behavior::BehaviorNode {
   void CalculateEnemyThreat(behavior::ExecuteContext& ctx, const Player* enemy);
   void CalculateTeamThreat(behavior::ExecuteContext& ctx, const Player* enemy);
 
-  std::unique_ptr<path::PathNodeSearch> search_;
+  path::PathNodeSearch* search_ = nullptr;
   bool high_side_;
-  Path base_path_;
 
   bool is_anchor_;
   bool enemy_is_leaker_;
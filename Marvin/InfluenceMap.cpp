@@ -1,6 +1,7 @@
 #include "InfluenceMap.h"
 
 #include  <queue>
+#include <unordered_set>
 #include "Bot.h"
 #include "RayCaster.h"
 #include "Debug.h"
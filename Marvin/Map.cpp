@@ -1,12 +1,17 @@
 #include "Map.h"
 
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 
 #include "RegionRegistry.h"
 
 namespace marvin {
 
-Map::Map(const TileData& tile_data) : tile_data_(tile_data) {}
+Map::Map(const TileData& tile_data)
+    : tile_data_(tile_data), square_clearance_(kMapExtent * kMapExtent), cover_clearance_(kMapExtent * kMapExtent) {
+  UpdateClearance(0, 0, kMapExtent - 1, kMapExtent - 1);
+}
 
 TileId Map::GetTileId(u16 x, u16 y) const {
   if (x >= 1024 || y >= 1024) return 0;
@@ -20,7 +25,14 @@ bool Map::IsSolid(u16 x, u16 y) const {
 
 void Map::SetTileId(u16 x, u16 y, TileId id) {
   if (x >= 1024 || y >= 1024) return;
+
+  bool solid = IsSolid(x, y);
+
   tile_data_[y * kMapExtent + x] = id;
+
+  if (IsSolid(x, y) != solid) {
+    UpdateClearance(x, y, x, y);
+  }
 }
 
 void Map::SetTileId(const Vector2f& position, TileId id) {
@@ -30,6 +42,71 @@ void Map::SetTileId(const Vector2f& position, TileId id) {
   SetTileId(x, y, id);
 }
 
+void Map::UpdateClearance(int min_x, int min_y, int max_x, int max_y) {
+  // Squares with a top left corner further away than the max clearance can't reach into the area.
+  int square_min_x = std::max(min_x - kMaxClearance + 1, 0);
+  int square_min_y = std::max(min_y - kMaxClearance + 1, 0);
+
+  // Each square is one larger than the smallest square to its right, below it and diagonal from it.
+  for (int y = max_y; y >= square_min_y; --y) {
+    for (int x = max_x; x >= square_min_x; --x) {
+      u8 size = 0;
+
+      if (!IsSolid((u16)x, (u16)y)) {
+        u8 right = GetSquareClearance((u16)(x + 1), (u16)y);
+        u8 down = GetSquareClearance((u16)x, (u16)(y + 1));
+        u8 diagonal = GetSquareClearance((u16)(x + 1), (u16)(y + 1));
+
+        size = std::min<u8>(std::min(std::min(right, down), diagonal) + 1, kMaxClearance);
+      }
+
+      square_clearance_[y * kMapExtent + x] = size;
+    }
+  }
+
+  int cover_max_x = std::min(max_x + kMaxClearance - 1, (int)kMapExtent - 1);
+  int cover_max_y = std::min(max_y + kMaxClearance - 1, (int)kMapExtent - 1);
+  // Rows above the changed squares still need their reach for the covers below them.
+  int reach_min_y = std::max(square_min_y - kMaxClearance + 1, 0);
+  int width = cover_max_x - square_min_x + 1;
+
+  // The largest square from the same row that reaches each tile. If it doesn't reach far enough down to cover a
+  // tile then none of the smaller ones from that row do either, so the columns only need to check this value.
+  std::vector<u8> row_reach(width * (cover_max_y - reach_min_y + 1));
+
+  for (int y = reach_min_y; y <= cover_max_y; ++y) {
+    for (int x = square_min_x; x <= cover_max_x; ++x) {
+      u8 best = 0;
+
+      for (int offset = 0; offset < kMaxClearance && offset <= x && best < kMaxClearance; ++offset) {
+        u8 size = square_clearance_[y * kMapExtent + x - offset];
+
+        if (size > offset && size > best) {
+          best = size;
+        }
+      }
+
+      row_reach[(y - reach_min_y) * width + (x - square_min_x)] = best;
+    }
+  }
+
+  for (int y = square_min_y; y <= cover_max_y; ++y) {
+    for (int x = square_min_x; x <= cover_max_x; ++x) {
+      u8 best = 0;
+
+      for (int offset = 0; offset < kMaxClearance && offset <= y && best < kMaxClearance; ++offset) {
+        u8 size = row_reach[(y - offset - reach_min_y) * width + (x - square_min_x)];
+
+        if (size > offset && size > best) {
+          best = size;
+        }
+      }
+
+      cover_clearance_[y * kMapExtent + x] = best;
+    }
+  }
+}
+
 bool Map::IsSolid(TileId id) const {
   if (id == 0) return false;
   if (id >= 162 && id <= 169) return false;  // treat doors as non-solid
@@ -79,6 +156,14 @@ bool Map::CanPathOn(const Vector2f& position, float radius) const {
     } break;
   }
 
+  int start_x = (int)std::floor(position.x) - (int)offset.x;
+  int start_y = (int)std::floor(position.y) - (int)offset.y;
+
+  // The clearance field answers this directly unless the square hangs off the top or left side of the map.
+  if (tile_diameter <= kMaxClearance && start_x >= 0 && start_y >= 0) {
+    return GetSquareClearance((u16)start_x, (u16)start_y) >= tile_diameter;
+  }
+
   for (float y = -offset.y; y < tile_diameter - offset.y; ++y) {
     for (float x = -offset.x; x < tile_diameter - offset.x; ++x) {
       uint16_t world_x = (uint16_t)(position.x + x);
@@ -138,6 +223,10 @@ bool Map::CornerPointCheck(const Vector2f& start, bool right_corner_check, bool
     start_y -= (diameter - 1);
   }
 
+  if (diameter <= kMaxClearance && start_x < 1024 && start_y < 1024) {
+    return GetSquareClearance(start_x, start_y) >= diameter;
+  }
+
   u16 end_x = start_x + (diameter - 1);
   u16 end_y = start_y + (diameter - 1);
 
@@ -152,6 +241,9 @@ bool Map::CornerPointCheck(const Vector2f& start, bool right_corner_check, bool
 }
 
 bool Map::CornerPointCheck(int sX, int sY, int diameter) const {
+  if (diameter <= kMaxClearance && sX >= 0 && sY >= 0) {
+    return GetSquareClearance((u16)sX, (u16)sY) >= diameter;
+  }
 
   for (int y = 0; y < diameter; ++y) {
     for (int x = 0; x < diameter; ++x) {
@@ -226,6 +318,10 @@ bool Map::CanOccupy(const Vector2f& position, float radius) const {
       return true;
   }
 
+  if (tile_diameter <= kMaxClearance) {
+    return GetCoverClearance((u16)position.x, (u16)position.y) >= tile_diameter;
+  }
+
   for (int y = -(tile_diameter - 1); y <= 0; ++y) {
     for (int x = -(tile_diameter -1); x <= 0; ++x) {
       if (CornerPointCheck((int)position.x + x, (int)position.y + y, tile_diameter)) {
@@ -245,6 +341,14 @@ bool Map::CanOccupyRadius(const Vector2f& position, float radius) const {
 
   radius = std::floor(radius + 0.5f);
 
+  int start_x = (int)std::floor(position.x - radius);
+  int start_y = (int)std::floor(position.y - radius);
+  int diameter = (int)radius * 2 + 1;
+
+  if (diameter <= kMaxClearance && start_x >= 0 && start_y >= 0) {
+    return GetSquareClearance((u16)start_x, (u16)start_y) >= diameter;
+  }
+
   for (float y = -radius; y <= radius; ++y) {
     for (float x = -radius; x <= radius; ++x) {
       uint16_t world_x = (uint16_t)(position.x + x);
@@ -16,6 +16,9 @@ using TileData = std::vector<TileId>;
 
 constexpr TileId kSafeTileId = 171;
 
+// Clearance values are capped at this many tiles. Checks for anything larger fall back to scanning the tiles.
+constexpr u8 kMaxClearance = 8;
+
 class Map {
  public:
   Map(const TileData& tile_data);
@@ -35,11 +38,27 @@ class Map {
   void SetTileId(u16 x, u16 y, TileId id);
   void SetTileId(const Vector2f& position, TileId id);
 
+  // Size of the largest open square that has its top left corner on the tile.
+  inline u8 GetSquareClearance(u16 x, u16 y) const {
+    if (x >= 1024 || y >= 1024) return 0;
+    return square_clearance_[y * kMapExtent + x];
+  }
+  // Size of the largest open square that covers the tile.
+  inline u8 GetCoverClearance(u16 x, u16 y) const {
+    if (x >= 1024 || y >= 1024) return 0;
+    return cover_clearance_[y * kMapExtent + x];
+  }
+
   static std::unique_ptr<Map> Load(const char* filename);
   static std::unique_ptr<Map> Load(const std::string& filename);
 
  private:
+  // Recalculates the clearance of the tiles whose squares can reach into the area.
+  void UpdateClearance(int min_x, int min_y, int max_x, int max_y);
+
   TileData tile_data_;
+  std::vector<u8> square_clearance_;
+  std::vector<u8> cover_clearance_;
 };
 
 }  // namespace marvin
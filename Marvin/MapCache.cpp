@@ -0,0 +1,257 @@
+#include "MapCache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Debug.h"
+#include "Map.h"
+#include "RegionRegistry.h"
+#include "path/Pathfinder.h"
+#include "platform/Platform.h"
+
+namespace marvin {
+
+constexpr u32 kCacheMagic = 0x4D564E43;  // 'MVNC'
+constexpr const char* kCacheDirectory = "marvin_cache";
+
+// Read only view of a whole file that is unmapped when it goes out of scope.
+class MappedFile {
+ public:
+  MappedFile(const std::string& filename) {
+    file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (file_ == INVALID_HANDLE_VALUE) return;
+
+    LARGE_INTEGER size;
+
+    if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0) return;
+
+    mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    if (mapping_ == NULL) return;
+
+    data_ = (const u8*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+
+    if (data_ != nullptr) {
+      size_ = (std::size_t)size.QuadPart;
+    }
+  }
+
+  ~MappedFile() {
+    if (data_ != nullptr) UnmapViewOfFile(data_);
+    if (mapping_ != NULL) CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+  }
+
+  const u8* GetData() const { return data_; }
+  std::size_t GetSize() const { return size_; }
+
+ private:
+  HANDLE file_ = INVALID_HANDLE_VALUE;
+  HANDLE mapping_ = NULL;
+  const u8* data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+// FNV-1a over every tile in the map.
+static u64 HashMap(const Map& map) {
+  u64 hash = 0xCBF29CE484222325ULL;
+
+  for (u16 y = 0; y < kMapExtent; ++y) {
+    for (u16 x = 0; x < kMapExtent; ++x) {
+      hash ^= map.GetTileId(x, y);
+      hash *= 0x100000001B3ULL;
+    }
+  }
+
+  return hash;
+}
+
+void CacheWriter::WriteBlock(const void* data, std::size_t size) {
+  u32 block_size = (u32)size;
+
+  output_.write((const char*)&block_size, sizeof(block_size));
+
+  if (size > 0) {
+    output_.write((const char*)data, size);
+  }
+}
+
+bool CacheReader::ReadBlock(void* data, std::size_t size) {
+  u32 block_size = 0;
+
+  if (position_ + sizeof(block_size) > size_) return false;
+
+  memcpy(&block_size, data_ + position_, sizeof(block_size));
+  position_ += sizeof(block_size);
+
+  if (block_size != size || position_ + size > size_) return false;
+
+  if (size > 0) {
+    memcpy(data, data_ + position_, size);
+  }
+
+  position_ += size;
+  return true;
+}
+
+MapCache::MapCache(const Map& map, float radius) : map_hash_(HashMap(map)), radius_((u16)(radius * 16.0f + 0.5f)) {
+  char filename[64];
+
+  sprintf(filename, "%016llx_%u.cache", (unsigned long long)map_hash_, (unsigned int)radius_);
+
+  filename_ = GetWorkingDirectory() + "\\" + kCacheDirectory + "\\" + filename;
+}
+
+MapCache::Header MapCache::CreateHeader() const {
+  Header header = {};
+
+  header.magic = kCacheMagic;
+  header.version = kVersion;
+  header.map_hash = map_hash_;
+  header.radius = radius_;
+  header.region_index_size = (u16)sizeof(RegionRegistry::RegionLabel);
+
+  return header;
+}
+
+MapCacheLoad MapCache::Load(const Map& map, RegionRegistry& regions, path::Pathfinder& pathfinder) {
+  MappedFile file(filename_);
+
+  if (file.GetData() == nullptr || file.GetSize() < sizeof(Header)) return MapCacheLoad::Missing;
+
+  Header header;
+  Header expected = CreateHeader();
+
+  memcpy(&header, file.GetData(), sizeof(Header));
+
+  if (header.magic != expected.magic || header.version != expected.version || header.map_hash != expected.map_hash ||
+      header.radius != expected.radius || header.region_index_size != expected.region_index_size ||
+      header.payload_size != file.GetSize() - sizeof(Header)) {
+    debug_log << "map cache " << filename_ << " is out of date" << std::endl;
+    return MapCacheLoad::Missing;
+  }
+
+  CacheReader reader(file.GetData() + sizeof(Header), (std::size_t)header.payload_size);
+
+  if (!regions.Load(reader) || !pathfinder.LoadMapData(map, reader)) {
+    error_log << "map cache " << filename_ << " is corrupt" << std::endl;
+    return MapCacheLoad::Corrupt;
+  }
+
+  u32 set_count = 0;
+  std::vector<BasePathSet> base_paths;
+
+  if (!reader.Read(set_count)) return MapCacheLoad::Corrupt;
+
+  for (u32 i = 0; i < set_count; ++i) {
+    BasePathSet set;
+    u32 path_count = 0;
+
+    if (!reader.ReadVector(set.starts) || !reader.ReadVector(set.ends) || !reader.Read(set.radius)) {
+      return MapCacheLoad::Corrupt;
+    }
+
+    if (!reader.Read(path_count)) return MapCacheLoad::Corrupt;
+
+    set.paths.resize(path_count);
+
+    for (std::vector<Vector2f>& path : set.paths) {
+      if (!reader.ReadVector(path)) return MapCacheLoad::Corrupt;
+    }
+
+    base_paths.push_back(std::move(set));
+  }
+
+  base_paths_ = std::move(base_paths);
+  dirty_ = false;
+
+  return MapCacheLoad::Loaded;
+}
+
+bool MapCache::Save(const RegionRegistry& regions, const path::Pathfinder& pathfinder) {
+  CreateDirectoryA((GetWorkingDirectory() + "\\" + kCacheDirectory).c_str(), NULL);
+
+  // Other bots can be reading or writing the same file, so it's written to a temporary file and moved over it.
+  std::string temp_filename = filename_ + "." + std::to_string(GetCurrentProcessId()) + ".tmp";
+
+  {
+    std::ofstream output(temp_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+
+    if (!output.is_open()) return false;
+
+    Header header = CreateHeader();
+
+    output.write((const char*)&header, sizeof(header));
+
+    CacheWriter writer(output);
+
+    regions.Save(writer);
+    pathfinder.SaveMapData(writer);
+
+    writer.Write((u32)base_paths_.size());
+
+    for (const BasePathSet& set : base_paths_) {
+      writer.WriteVector(set.starts);
+      writer.WriteVector(set.ends);
+      writer.Write(set.radius);
+      writer.Write((u32)set.paths.size());
+
+      for (const std::vector<Vector2f>& path : set.paths) {
+        writer.WriteVector(path);
+      }
+    }
+
+    header.payload_size = (u64)output.tellp() - sizeof(header);
+
+    output.seekp(0);
+    output.write((const char*)&header, sizeof(header));
+
+    if (!output.good()) {
+      output.close();
+      DeleteFileA(temp_filename.c_str());
+      return false;
+    }
+  }
+
+  if (!MoveFileExA(temp_filename.c_str(), filename_.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+    DeleteFileA(temp_filename.c_str());
+    return false;
+  }
+
+  dirty_ = false;
+  return true;
+}
+
+bool MapCache::FindBasePaths(const std::vector<Vector2f>& starts, const std::vector<Vector2f>& ends, float radius,
+                             std::vector<std::vector<Vector2f>>& paths) const {
+  for (const BasePathSet& set : base_paths_) {
+    if (set.radius != radius || set.starts.size() != starts.size() || set.ends.size() != ends.size()) continue;
+
+    if (!std::equal(starts.begin(), starts.end(), set.starts.begin()) ||
+        !std::equal(ends.begin(), ends.end(), set.ends.begin())) {
+      continue;
+    }
+
+    paths.insert(paths.end(), set.paths.begin(), set.paths.end());
+    return true;
+  }
+
+  return false;
+}
+
+void MapCache::AddBasePaths(const std::vector<Vector2f>& starts, const std::vector<Vector2f>& ends, float radius,
+                            const std::vector<std::vector<Vector2f>>& paths) {
+  BasePathSet set;
+
+  set.starts = starts;
+  set.ends = ends;
+  set.radius = radius;
+  set.paths = paths;
+
+  base_paths_.push_back(std::move(set));
+  dirty_ = true;
+}
+
+}  // namespace marvin
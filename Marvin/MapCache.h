@@ -0,0 +1,147 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Types.h"
+#include "Vector2f.h"
+
+namespace marvin {
+
+class Map;
+class RegionRegistry;
+
+namespace path {
+class Pathfinder;
+}  // namespace path
+
+// Writes blocks of raw data to a cache file. Each block starts with its size so a reader that was built with
+// different types rejects the file instead of reading garbage.
+class CacheWriter {
+ public:
+  CacheWriter(std::ofstream& output) : output_(output) {}
+
+  template <typename T>
+  void Write(const T& value) {
+    WriteBlock(&value, sizeof(T));
+  }
+
+  template <typename T>
+  void WriteArray(const T* data, std::size_t count) {
+    WriteBlock(data, sizeof(T) * count);
+  }
+
+  template <typename T>
+  void WriteVector(const std::vector<T>& data) {
+    Write((u32)data.size());
+    WriteArray(data.data(), data.size());
+  }
+
+ private:
+  void WriteBlock(const void* data, std::size_t size);
+
+  std::ofstream& output_;
+};
+
+// Reads the blocks written by CacheWriter out of a mapped cache file.
+class CacheReader {
+ public:
+  CacheReader(const u8* data, std::size_t size) : data_(data), size_(size) {}
+
+  template <typename T>
+  bool Read(T& value) {
+    return ReadBlock(&value, sizeof(T));
+  }
+
+  template <typename T>
+  bool ReadArray(T* data, std::size_t count) {
+    return ReadBlock(data, sizeof(T) * count);
+  }
+
+  template <typename T>
+  bool ReadVector(std::vector<T>& data) {
+    u32 count = 0;
+
+    if (!Read(count)) return false;
+
+    data.resize(count);
+
+    return ReadArray(data.data(), data.size());
+  }
+
+ private:
+  bool ReadBlock(void* data, std::size_t size);
+
+  const u8* data_;
+  std::size_t size_;
+  std::size_t position_ = 0;
+};
+
+enum class MapCacheLoad {
+  // Everything was copied out of the file.
+  Loaded,
+  // There's no file or it was written for a different version, map or radius. Nothing was copied out of it.
+  Missing,
+  // The file failed part way through, so the regions and pathfinder may be partially loaded.
+  Corrupt
+};
+
+// Stores the preprocessed data for a map on disk so every bot that loads the same map can skip building it.
+// Files are named by a hash of the map tiles and the ship radius. A file that was written by a different version is
+// rebuilt the next time the map is loaded.
+class MapCache {
+ public:
+  // This needs to be increased whenever the file layout or the algorithms that create the cached data change.
+  static constexpr u32 kVersion = 6;
+
+  MapCache(const Map& map, float radius);
+
+  // Maps the cache file into memory and copies the regions, pathfinder data and base paths out of it.
+  // The regions and pathfinder need to be created again before building them if the file was corrupt.
+  MapCacheLoad Load(const Map& map, RegionRegistry& regions, path::Pathfinder& pathfinder);
+
+  // Writes the regions, the pathfinder data and every base path set to the cache file.
+  // The pathfinder data includes the cluster graph if it was created.
+  bool Save(const RegionRegistry& regions, const path::Pathfinder& pathfinder);
+
+  // Appends the cached base paths if they were created from the same points with the same radius.
+  bool FindBasePaths(const std::vector<Vector2f>& starts, const std::vector<Vector2f>& ends, float radius,
+                     std::vector<std::vector<Vector2f>>& paths) const;
+  void AddBasePaths(const std::vector<Vector2f>& starts, const std::vector<Vector2f>& ends, float radius,
+                    const std::vector<std::vector<Vector2f>>& paths);
+
+  // True when there are base paths that haven't been saved yet.
+  bool IsDirty() const { return dirty_; }
+  u64 GetMapHash() const { return map_hash_; }
+
+ private:
+  struct BasePathSet {
+    std::vector<Vector2f> starts;
+    std::vector<Vector2f> ends;
+    float radius;
+    std::vector<std::vector<Vector2f>> paths;
+  };
+
+  struct Header {
+    u32 magic;
+    u32 version;
+    u64 map_hash;
+    u64 payload_size;
+    u16 radius;
+    u16 region_index_size;
+    u32 reserved;
+  };
+
+  Header CreateHeader() const;
+
+  u64 map_hash_;
+  // Ship radius in sixteenths of a tile.
+  u16 radius_;
+  std::string filename_;
+
+  std::vector<BasePathSet> base_paths_;
+  bool dirty_ = false;
+};
+
+}  // namespace marvin
@@ -1,11 +1,51 @@
 #include "RegionRegistry.h"
 
+#include <algorithm>
+#include <cassert>
+#include <unordered_map>
 #include <vector>
 #include "Debug.h"
+#include "MapCache.h"
 #include "Map.h"
+#include "WorkerPool.h"
 
 namespace marvin {
 
+constexpr uint32_t kNoComponent = 0xFFFFFFFF;
+
+// Roots are always the lowest index in their set, so every parent comes before its children in scan order.
+static uint32_t FindSetRoot(std::vector<uint32_t>& parents, uint32_t index) {
+  while (parents[index] != index) {
+    parents[index] = parents[parents[index]];
+    index = parents[index];
+  }
+  return index;
+}
+
+static void UnionSets(std::vector<uint32_t>& parents, uint32_t first, uint32_t second) {
+  first = FindSetRoot(parents, first);
+  second = FindSetRoot(parents, second);
+
+  if (first < second) {
+    parents[second] = first;
+  } else if (second < first) {
+    parents[first] = second;
+  }
+}
+
+// Replaces the parents with compact set ids in one sweep and returns the number of sets.
+static uint32_t FlattenSets(std::vector<uint32_t>& parents) {
+  uint32_t count = 0;
+
+  for (uint32_t i = 0; i < parents.size(); ++i) {
+    if (parents[i] == kNoComponent) continue;
+
+    parents[i] = parents[i] == i ? count++ : parents[parents[i]];
+  }
+
+  return count;
+}
+
 /*
 This method sweeps the fill area 4 times.  For each sweep, it takes the ships radius, and pins the orientation of the ship
 to each of its 4 corners, then flood fills the map.  Pinning the orientation for each sweep is important because it wont allow
@@ -14,33 +54,32 @@ wall.  The fix to fill that space is to run a pass for each corner of the ship w
 */
 void RegionRegistry::FloodFillRegion(const Map& map, const MapCoord& coord, RegionIndex region_index,
                                           float radius) {
-  FloodFillEmptyRegion(map, coord, 9000, false, false, radius);
-  FloodFillEmptyRegion(map, coord, 9001, false, true, radius);
-  FloodFillEmptyRegion(map, coord, 9002, true, false, radius);
-  FloodFillEmptyRegion(map, coord, 9003, true, true, radius);
+  RegionLabel label = GetLabel(region_index);
 
-  for (std::size_t i = 0; i < 1024 * 1024; i++) {
-    for (size_t j = 9000; j <= 9003; j++) {
-      if (coord_regions_[i] == j) {
-        coord_regions_[i] = region_index;
-      }
+  FloodFillEmptyRegion(map, coord, kFillPassLabel, false, false, radius);
+  FloodFillEmptyRegion(map, coord, kFillPassLabel + 1, false, true, radius);
+  FloodFillEmptyRegion(map, coord, kFillPassLabel + 2, true, false, radius);
+  FloodFillEmptyRegion(map, coord, kFillPassLabel + 3, true, true, radius);
 
-       if (unordered_solids_[i] == j) {
-        unordered_solids_[i] = region_index;
-       }
+  for (std::size_t i = 0; i < 1024 * 1024; i++) {
+    if (coord_regions_[i] >= kFillPassLabel && coord_regions_[i] < kFillPassLabel + 4) {
+      coord_regions_[i] = label;
+    }
 
-       if (outside_edges_[i] == j) {
-         outside_edges_[i] = region_index;
-       }
+    if (unordered_solids_[i] >= kFillPassLabel && unordered_solids_[i] < kFillPassLabel + 4) {
+      unordered_solids_[i] = label;
     }
   }
 
+  // Regions past the limit don't have a label to find their solids with.
+  if (label == kUndefinedLabel) return;
+
   MapCoord top_tile = MapCoord(9999, 9999);
 
   // find a tile in the set with the lowest Y coordinate, this must be part of the outside edge
   for (uint16_t y = 0; y < 1024; ++y) {
     for (uint16_t x = 0; x < 1024; ++x) {
-      if (unordered_solids_[y * 1024 + x] == region_index) {
+      if (unordered_solids_[y * 1024 + x] == label) {
         if (y < top_tile.y) {
           top_tile = Vector2f(x, y);
         }
@@ -51,12 +90,12 @@ void RegionRegistry::FloodFillRegion(const Map& map, const MapCoord& coord, Regi
   FloodFillSolidRegion(map, top_tile, region_index);
 }
 
-void RegionRegistry::FloodFillEmptyRegion(const Map& map, const MapCoord& coord, RegionIndex region_index,
+void RegionRegistry::FloodFillEmptyRegion(const Map& map, const MapCoord& coord, RegionLabel label,
                                           bool right_corner_check, bool bottom_corner_check, float radius) {
 
   if (!map.CornerPointCheck(Vector2f(coord.x, coord.y), right_corner_check, bottom_corner_check, radius)) return;
 
-  coord_regions_[coord.y * 1024 + coord.x] = region_index;
+  coord_regions_[coord.y * 1024 + coord.x] = label;
 
   std::vector<MapCoord> stack;
 
@@ -73,45 +112,45 @@ void RegionRegistry::FloodFillEmptyRegion(const Map& map, const MapCoord& coord,
 
     if (IsValidPosition(west)) {
       if (map.CornerPointCheck(Vector2f(west.x, west.y), right_corner_check, bottom_corner_check, radius)) {
-        if (coord_regions_[west.y * 1024 + west.x] != region_index) {
-          coord_regions_[west.y * 1024 + west.x] = region_index;
+        if (coord_regions_[west.y * 1024 + west.x] != label) {
+          coord_regions_[west.y * 1024 + west.x] = label;
           stack.push_back(west);
         }
-      } else if (unordered_solids_[west.y * 1024 + west.x] == kUndefinedRegion) {
-        unordered_solids_[west.y * 1024 + west.x] = region_index;
+      } else if (unordered_solids_[west.y * 1024 + west.x] == kUndefinedLabel) {
+        unordered_solids_[west.y * 1024 + west.x] = label;
       }
     }
 
     if (IsValidPosition(east)) {
       if (map.CornerPointCheck(Vector2f(east.x, east.y), right_corner_check, bottom_corner_check, radius)) {
-        if (coord_regions_[east.y * 1024 + east.x] != region_index) {
-          coord_regions_[east.y * 1024 + east.x] = region_index;
+        if (coord_regions_[east.y * 1024 + east.x] != label) {
+          coord_regions_[east.y * 1024 + east.x] = label;
           stack.push_back(east);
         }
-      } else if (unordered_solids_[east.y * 1024 + east.x] == kUndefinedRegion) {
-        unordered_solids_[east.y * 1024 + east.x] = region_index;
+      } else if (unordered_solids_[east.y * 1024 + east.x] == kUndefinedLabel) {
+        unordered_solids_[east.y * 1024 + east.x] = label;
       }
     }
 
     if (IsValidPosition(north)) {
       if (map.CornerPointCheck(Vector2f(north.x, north.y), right_corner_check, bottom_corner_check, radius)) {
-        if (coord_regions_[north.y * 1024 + north.x] != region_index) {
-          coord_regions_[north.y * 1024 + north.x] = region_index;
+        if (coord_regions_[north.y * 1024 + north.x] != label) {
+          coord_regions_[north.y * 1024 + north.x] = label;
           stack.push_back(north);
         }
-      } else if (unordered_solids_[north.y * 1024 + north.x] == kUndefinedRegion) {
-        unordered_solids_[north.y * 1024 + north.x] = region_index;
+      } else if (unordered_solids_[north.y * 1024 + north.x] == kUndefinedLabel) {
+        unordered_solids_[north.y * 1024 + north.x] = label;
       }
     }
 
     if (IsValidPosition(south)) {
       if (map.CornerPointCheck(Vector2f(south.x, south.y), right_corner_check, bottom_corner_check, radius)) {
-        if (coord_regions_[south.y * 1024 + south.x] != region_index) {
-          coord_regions_[south.y * 1024 + south.x] = region_index;
+        if (coord_regions_[south.y * 1024 + south.x] != label) {
+          coord_regions_[south.y * 1024 + south.x] = label;
           stack.push_back(south);
         }
-      } else if (unordered_solids_[south.y * 1024 + south.x] == kUndefinedRegion) {
-        unordered_solids_[south.y * 1024 + south.x] = region_index;
+      } else if (unordered_solids_[south.y * 1024 + south.x] == kUndefinedLabel) {
+        unordered_solids_[south.y * 1024 + south.x] = label;
       }
     }
   }
@@ -123,8 +162,12 @@ void RegionRegistry::FloodFillSolidRegion(const Map& map, const MapCoord& coord,
  
     if (!IsValidPosition(Vector2f(coord.x, coord.y))) return;
 
+  RegionLabel label = GetLabel(region_index);
+
+  if (label == kUndefinedLabel) return;
+
   //outside_edges_[coord] = region_index;
-  outside_edges_[coord.y * 1024 + coord.x] = region_index;
+  SetEdge(coord.y * 1024 + coord.x);
   std::vector<MapCoord> stack;
 
   stack.push_back(coord);
@@ -143,104 +186,97 @@ void RegionRegistry::FloodFillSolidRegion(const Map& map, const MapCoord& coord,
     const MapCoord south(current.x, current.y + 1);
 
     if (IsValidPosition(Vector2f(west.x, west.y))) {
-      if (unordered_solids_[west.y * 1024 + west.x] == region_index) {
+      if (unordered_solids_[west.y * 1024 + west.x] == label) {
 
         stack.push_back(west);
-        unordered_solids_[west.y * 1024 + west.x] = 9999;
+        unordered_solids_[west.y * 1024 + west.x] = kConsumedSolidLabel;
 
-        if (outside_edges_[west.y * 1024 + west.x] == kUndefinedRegion && !map.CanOccupy(Vector2f(west.x, west.y), 0.8f)) {
-          outside_edges_[west.y * 1024 + west.x] = region_index;
+        if (!map.CanOccupy(Vector2f(west.x, west.y), 0.8f)) {
+          SetEdge(west.y * 1024 + west.x);
         }
       }
     }
 
     if (IsValidPosition(Vector2f(northwest.x, northwest.y))) {
-      if (unordered_solids_[northwest.y * 1024 + northwest.x] == region_index) {
+      if (unordered_solids_[northwest.y * 1024 + northwest.x] == label) {
 
         stack.push_back(northwest);
-        unordered_solids_[northwest.y * 1024 + northwest.x] = 9999;
+        unordered_solids_[northwest.y * 1024 + northwest.x] = kConsumedSolidLabel;
 
-        if (outside_edges_[northwest.y * 1024 + northwest.x] == kUndefinedRegion &&
-            !map.CanOccupy(Vector2f(northwest.x, northwest.y), 0.8f)) {
-          outside_edges_[northwest.y * 1024 + northwest.x] = region_index;
+        if (!map.CanOccupy(Vector2f(northwest.x, northwest.y), 0.8f)) {
+          SetEdge(northwest.y * 1024 + northwest.x);
         }
       }
     }
 
     if (IsValidPosition(Vector2f(southwest.x, southwest.y))) {
-      if (unordered_solids_[southwest.y * 1024 + southwest.x] == region_index) {
+      if (unordered_solids_[southwest.y * 1024 + southwest.x] == label) {
 
         stack.push_back(southwest);
-        unordered_solids_[southwest.y * 1024 + southwest.x] = 9999;
+        unordered_solids_[southwest.y * 1024 + southwest.x] = kConsumedSolidLabel;
 
-        if (outside_edges_[southwest.y * 1024 + southwest.x] == kUndefinedRegion &&
-            !map.CanOccupy(Vector2f(southwest.x, southwest.y), 0.8f)) {
-          outside_edges_[southwest.y * 1024 + southwest.x] = region_index;
+        if (!map.CanOccupy(Vector2f(southwest.x, southwest.y), 0.8f)) {
+          SetEdge(southwest.y * 1024 + southwest.x);
         }
       }
     }
 
     if (IsValidPosition(Vector2f(east.x, east.y))) {
-      if (unordered_solids_[east.y * 1024 + east.x] == region_index) {
+      if (unordered_solids_[east.y * 1024 + east.x] == label) {
 
         stack.push_back(east);
-        unordered_solids_[east.y * 1024 + east.x] = 9999;
+        unordered_solids_[east.y * 1024 + east.x] = kConsumedSolidLabel;
 
-        if (outside_edges_[east.y * 1024 + east.x] == kUndefinedRegion &&
-            !map.CanOccupy(Vector2f(east.x, east.y), 0.8f)) {
-          outside_edges_[east.y * 1024 + east.x] = region_index;
+        if (!map.CanOccupy(Vector2f(east.x, east.y), 0.8f)) {
+          SetEdge(east.y * 1024 + east.x);
         }
       }
     }
 
     if (IsValidPosition(Vector2f(northeast.x, northeast.y))) {
-      if (unordered_solids_[northeast.y * 1024 + northeast.x] == region_index) {
+      if (unordered_solids_[northeast.y * 1024 + northeast.x] == label) {
 
         stack.push_back(northeast);
-        unordered_solids_[northeast.y * 1024 + northeast.x] = 9999;
+        unordered_solids_[northeast.y * 1024 + northeast.x] = kConsumedSolidLabel;
 
-        if (outside_edges_[northeast.y * 1024 + northeast.x] == kUndefinedRegion &&
-            !map.CanOccupy(Vector2f(northeast.x, northeast.y), 0.8f)) {
-          outside_edges_[northeast.y * 1024 + northeast.x] = region_index;
+        if (!map.CanOccupy(Vector2f(northeast.x, northeast.y), 0.8f)) {
+          SetEdge(northeast.y * 1024 + northeast.x);
         }
       }
     }
 
     if (IsValidPosition(Vector2f(southeast.x, southeast.y))) {
-      if (unordered_solids_[southeast.y * 1024 + southeast.x] == region_index) {
+      if (unordered_solids_[southeast.y * 1024 + southeast.x] == label) {
 
         stack.push_back(southeast);
-        unordered_solids_[southeast.y * 1024 + southeast.x] = 9999;
+        unordered_solids_[southeast.y * 1024 + southeast.x] = kConsumedSolidLabel;
 
-        if (outside_edges_[southeast.y * 1024 + southeast.x] == kUndefinedRegion &&
-            !map.CanOccupy(Vector2f(southeast.x, southeast.y), 0.8f)) {
-          outside_edges_[southeast.y * 1024 + southeast.x] = region_index;
+        if (!map.CanOccupy(Vector2f(southeast.x, southeast.y), 0.8f)) {
+          SetEdge(southeast.y * 1024 + southeast.x);
         }
       }
     }
 
     if (IsValidPosition(Vector2f(north.x, north.y))) {
-      if (unordered_solids_[north.y * 1024 + north.x] == region_index) {
+      if (unordered_solids_[north.y * 1024 + north.x] == label) {
 
         stack.push_back(north);
-        unordered_solids_[north.y * 1024 + north.x] = 9999;
+        unordered_solids_[north.y * 1024 + north.x] = kConsumedSolidLabel;
 
-        if (outside_edges_[north.y * 1024 + north.x] == kUndefinedRegion &&
-            !map.CanOccupy(Vector2f(north.x, north.y), 0.8f)) {
-          outside_edges_[north.y * 1024 + north.x] = region_index;
+        if (!map.CanOccupy(Vector2f(north.x, north.y), 0.8f)) {
+          SetEdge(north.y * 1024 + north.x);
         }
       }
     }
 
     if (IsValidPosition(Vector2f(south.x, south.y))) {
-      if (unordered_solids_[south.y * 1024 + south.x] == region_index) {
+      if (unordered_solids_[south.y * 1024 + south.x] == label) {
 
         stack.push_back(south);
-        unordered_solids_[south.y * 1024 + south.x] = 9999;
+        unordered_solids_[south.y * 1024 + south.x] = kConsumedSolidLabel;
 
-        if (outside_edges_[south.y * 1024 + south.x] == kUndefinedRegion &&
-            !map.CanOccupy(Vector2f(south.x, south.y), 0.8f)) {
-          outside_edges_[south.y * 1024 + south.x] = region_index;
+        if (!map.CanOccupy(Vector2f(south.x, south.y), 0.8f)) {
+          SetEdge(south.y * 1024 + south.x);
         }
       }
     }
@@ -311,6 +347,13 @@ void RegionRegistry::CreateRegions(const Map& map, std::vector<Vector2f> seed_po
 
   //unordered_solids_.clear();
 
+  // The regions loaded from the map cache already have the fills that were done before they were saved.
+  for (const SeedFill& fill : seed_fills_) {
+    if (fill.points == seed_points && fill.radius == radius) return;
+  }
+
+  seed_fills_.push_back(SeedFill{seed_points, radius});
+
   // use a seed point to find walls on only the desired regions
  // store tiles the ship cant fit on (needs work) to help determine the regions boundries
 
@@ -319,12 +362,16 @@ void RegionRegistry::CreateRegions(const Map& map, std::vector<Vector2f> seed_po
 
     FloodFillRegion(map, seed, index, radius);
 
+    RegionLabel label = GetLabel(index);
+
+    if (label == kUndefinedLabel) continue;
+
     MapCoord top_tile = MapCoord(9999, 9999);
 
     // find a tile in the set with the lowest Y coordinate, this must be part of the outside edge
     for (uint16_t y = 0; y < 1024; ++y) {
       for (uint16_t x = 0; x < 1024; ++x) {
-        if (unordered_solids_[y * 1024 + x] == index) {
+        if (unordered_solids_[y * 1024 + x] == label) {
           if (y < top_tile.y) {
             top_tile = Vector2f(x, y);
           }
@@ -337,44 +384,671 @@ void RegionRegistry::CreateRegions(const Map& map, std::vector<Vector2f> seed_po
 }
 
 // this method is not working at least for Extreme Games
+/*
+This labels the whole map in a fixed number of sweeps instead of flood filling every region and then scanning the
+whole map for its tiles.  It gives the same result as running FloodFillRegion from every unregistered tile in scan
+order.
+
+Each of the four corner passes is labelled with union-find, so a pass fill from a seed is the same as claiming the
+component that the seed is in.  A later region can claim a component that an earlier region already claimed, so a
+tile ends up in the last region that claimed one of its components.  The unordered solids belong to the first region
+that touched them, and the outside edge of a region is the 8 connected set of its solids around its top tile.
+*/
 void RegionRegistry::CreateAll(const Map& map, float radius) {
+  constexpr uint32_t kTileCount = 1024 * 1024;
+
+  label_roots_.clear();
+
+  // Pass p of tile i is stored at p * kTileCount + i. The passes are in the same order as in FloodFillRegion.
+  std::vector<uint32_t> components(kTileCount * 4, kNoComponent);
+
+  for (uint32_t pass = 0; pass < 4; ++pass) {
+    bool right_corner_check = pass >= 2;
+    bool bottom_corner_check = (pass & 1) != 0;
+
+    for (uint16_t y = 0; y < 1024; ++y) {
+      for (uint16_t x = 0; x < 1024; ++x) {
+        if (!map.CornerPointCheck(Vector2f(x, y), right_corner_check, bottom_corner_check, radius)) continue;
+
+        uint32_t node = pass * kTileCount + y * 1024 + x;
+
+        components[node] = node;
+
+        if (x > 0 && components[node - 1] != kNoComponent) {
+          UnionSets(components, node, node - 1);
+        }
+
+        if (y > 0 && components[node - 1024] != kNoComponent) {
+          UnionSets(components, node, node - 1024);
+        }
+      }
+    }
+  }
+
+  uint32_t component_count = FlattenSets(components);
+
+  // The first and last region to fill each component.
+  std::vector<RegionIndex> first_claims(component_count, kUndefinedRegion);
+  std::vector<RegionIndex> last_claims(component_count, kUndefinedRegion);
+
+  for (uint16_t y = 0; y < 1024; ++y) {
+    for (uint16_t x = 0; x < 1024; ++x) {
+      if (!map.CanOccupyRadius(Vector2f(x, y), radius)) continue;
+
+      uint32_t index = y * 1024 + x;
+      bool registered = false;
+
+      for (uint32_t pass = 0; pass < 4; ++pass) {
+        uint32_t component = components[pass * kTileCount + index];
+
+        if (component != kNoComponent && last_claims[component] != kUndefinedRegion) {
+          registered = true;
+          break;
+        }
+      }
+
+      if (registered) continue;
+
+      RegionIndex region_index = CreateRegion();
+
+      for (uint32_t pass = 0; pass < 4; ++pass) {
+        uint32_t component = components[pass * kTileCount + index];
+
+        if (component == kNoComponent) continue;
+
+        if (first_claims[component] == kUndefinedRegion) {
+          first_claims[component] = region_index;
+        }
+        last_claims[component] = region_index;
+      }
+    }
+  }
+
+  // The first region that touched each solid tile.
+  std::vector<RegionIndex> solids(kTileCount, kUndefinedRegion);
+  // The first solid tile of each region in scan order, which is where its outside edge fill starts.
+  std::vector<uint32_t> top_tiles(region_count_, kNoComponent);
+
+  for (uint16_t y = 0; y < 1024; ++y) {
+    for (uint16_t x = 0; x < 1024; ++x) {
+      uint32_t index = y * 1024 + x;
+      RegionIndex region_index = kUndefinedRegion;
+      RegionIndex solid_index = kUndefinedRegion;
+
+      for (uint32_t pass = 0; pass < 4; ++pass) {
+        uint32_t base = pass * kTileCount;
+        uint32_t component = components[base + index];
+
+        if (component != kNoComponent) {
+          RegionIndex claim = last_claims[component];
+
+          if (claim != kUndefinedRegion && (region_index == kUndefinedRegion || claim > region_index)) {
+            region_index = claim;
+          }
+          continue;
+        }
+
+        // A tile that fails the corner check is touched by every region that fills one of its neighbors in this pass.
+        // kUndefinedRegion is the largest index, so the minimum is the first region to touch it.
+        const uint32_t neighbors[] = {index - 1, index + 1, index - 1024, index + 1024};
+        const bool valid[] = {x > 0, x < 1023, y > 0, y < 1023};
+
+        for (std::size_t i = 0; i < 4; ++i) {
+          if (!valid[i]) continue;
+
+          uint32_t neighbor = components[base + neighbors[i]];
+
+          if (neighbor != kNoComponent && first_claims[neighbor] < solid_index) {
+            solid_index = first_claims[neighbor];
+          }
+        }
+      }
+
+      coord_regions_[index] = GetLabel(region_index);
+      solids[index] = solid_index;
+
+      if (solid_index != kUndefinedRegion && top_tiles[solid_index] == kNoComponent) {
+        top_tiles[solid_index] = index;
+      }
+    }
+  }
+
+  // Label the 8 connected sets of solids that belong to the same region.
+  std::vector<uint32_t>& solid_sets = components;
+  solid_sets.assign(kTileCount, kNoComponent);
+
   for (uint16_t y = 0; y < 1024; ++y) {
     for (uint16_t x = 0; x < 1024; ++x) {
-      MapCoord coord(x, y);
-
-      if (map.CanOccupyRadius(Vector2f(x, y), radius)) {
-        // if (!map.IsSolid(x, y)) {
-        // If the current coord is empty and hasn't been inserted into region
-        // map then create a new region and flood fill it
-        if (!IsRegistered(coord)) 
-        {
-          auto region_index = CreateRegion();
-          FloodFillRegion(map, coord, region_index, radius);
-
-          
+      uint32_t index = y * 1024 + x;
+      RegionIndex solid_index = solids[index];
+
+      if (solid_index == kUndefinedRegion) continue;
+
+      solid_sets[index] = index;
+
+      const uint32_t neighbors[] = {index - 1, index - 1025, index - 1024, index - 1023};
+      const bool valid[] = {x > 0, x > 0 && y > 0, y > 0, x < 1023 && y > 0};
+
+      for (std::size_t i = 0; i < 4; ++i) {
+        if (valid[i] && solids[neighbors[i]] == solid_index) {
+          UnionSets(solid_sets, index, neighbors[i]);
         }
       }
     }
   }
+
+  // The solid fill of each region only consumes its top tile if it reaches the top tile again through a neighbor.
+  std::vector<bool> lone_tops(region_count_, true);
+
+  for (RegionIndex region_index = 0; region_index < region_count_; ++region_index) {
+    uint32_t top = top_tiles[region_index];
+
+    if (top == kNoComponent) continue;
+
+    uint16_t top_x = top % 1024;
+    uint16_t top_y = top / 1024;
+
+    for (int dy = -1; dy <= 1; ++dy) {
+      for (int dx = -1; dx <= 1; ++dx) {
+        uint16_t x = top_x + dx;
+        uint16_t y = top_y + dy;
+
+        if ((dx == 0 && dy == 0) || x >= 1024 || y >= 1024) continue;
+
+        if (solids[y * 1024 + x] == region_index) {
+          lone_tops[region_index] = false;
+        }
+      }
+    }
+  }
+
+  for (uint16_t y = 0; y < 1024; ++y) {
+    for (uint16_t x = 0; x < 1024; ++x) {
+      uint32_t index = y * 1024 + x;
+      RegionIndex solid_index = solids[index];
+
+      unordered_solids_[index] = GetLabel(solid_index);
+
+      if (solid_index == kUndefinedRegion) continue;
+
+      // The outside edge is the set that holds the top tile. The top tile is the root of that set because roots are
+      // the lowest index in their set.
+      uint32_t top = top_tiles[solid_index];
+
+      if (FindSetRoot(solid_sets, index) != top) continue;
+
+      bool is_top = index == top;
+
+      if (is_top || !map.CanOccupy(Vector2f(x, y), 0.8f)) {
+        SetEdge(index);
+      }
+
+      // Mark the solids that the fill consumed so CreateRegions continues from the same solids as the fill left.
+      if (!is_top || !lone_tops[solid_index]) {
+        unordered_solids_[index] = kConsumedSolidLabel;
+      }
+    }
+  }
 }
 
-void RegionRegistry::DebugUpdate(Vector2f position) {
+void RegionRegistry::UpdateTile(const Map& map, MapCoord coord, float radius) {
+  if (!IsValidPosition(coord)) return;
 
-    RegionIndex index = GetRegionIndex(position);
+  int diameter = (int)((radius + 0.5f) * 2.0f);
 
-    for (uint16_t y = 0; y < 1024; ++y) {
-      for (uint16_t x = 0; x < 1024; ++x) {
-        if (index != -1 && unordered_solids_[y * 1024 + x] == index) {
-          Vector2f check = Vector2f(x, y);
-          //RenderWorldLine(position, check, check + Vector2f(1, 1), RGB(255, 255, 255));
-          //RenderWorldLine(position, check + Vector2f(0, 1), check + Vector2f(1, 0), RGB(255, 255, 255));
+  // These are the tiles whose corner checks cover the changed tile.
+  int min_x = std::max(coord.x - diameter + 1, 0);
+  int min_y = std::max(coord.y - diameter + 1, 0);
+  int max_x = std::min(coord.x + diameter - 1, 1023);
+  int max_y = std::min(coord.y + diameter - 1, 1023);
+
+  if (map.IsSolid(coord.x, coord.y)) {
+    SplitRegions(map, min_x, min_y, max_x, max_y, radius);
+  } else {
+    MergeRegions(map, min_x, min_y, max_x, max_y, radius);
+  }
+
+  UpdateEdges(map, coord);
+
+#if DEBUG_CHECK_REGION_UPDATES
+  rebuild_radius_ = radius;
+
+  if (rebuilding_) {
+    // The running rebuild copied the tiles before this change, so another one is started once it finishes.
+    rebuild_stale_ = true;
+    return;
+  }
+
+  StartRebuild(radius);
+#endif
+}
+
+RegionRegistry::~RegionRegistry() {
+  std::unique_lock<std::mutex> lock(rebuild_mutex_);
+
+  rebuild_done_.wait(lock, [this]() { return !rebuild_running_; });
+}
+
+void RegionRegistry::CollectRebuild() {
+  if (!rebuilding_) return;
+
+  std::size_t mismatches = 0;
+
+  {
+    std::lock_guard<std::mutex> lock(rebuild_mutex_);
+
+    if (rebuild_running_) return;
+
+    mismatches = rebuild_mismatches_;
+  }
+
+  rebuilding_ = false;
+
+  if (mismatches > 0) {
+    debug_log << "Region update disagreed with a full rebuild on " << mismatches << " tiles." << std::endl;
+  }
+
+  assert(mismatches == 0);
+
+  if (rebuild_stale_) {
+    rebuild_stale_ = false;
+    StartRebuild(rebuild_radius_);
+  }
+}
+
+void RegionRegistry::StartRebuild(float radius) {
+  // The workers build from a copy so the game can keep changing the tiles.
+  auto map = std::make_shared<Map>(map_);
+  auto labels = std::make_shared<std::vector<RegionLabel>>(1024 * 1024);
+
+  for (std::size_t i = 0; i < labels->size(); ++i) {
+    RegionLabel label = coord_regions_[i];
+
+    (*labels)[i] = label == kUndefinedLabel ? kUndefinedLabel : GetRootLabel(label);
+  }
+
+  std::vector<SeedFill> seed_fills = seed_fills_;
+
+  auto rebuild = [this, map, labels, seed_fills, radius]() {
+    auto rebuilt = std::make_unique<RegionRegistry>(*map);
+
+    rebuilt->CreateAll(*map, radius);
+
+    for (const SeedFill& fill : seed_fills) {
+      rebuilt->CreateRegions(*map, fill.points, fill.radius);
+    }
+
+    // The labels are numbered differently, so the tiles match if every updated label only ever lines up with one
+    // rebuilt label and the other way around.
+    std::vector<RegionLabel> forward(kUndefinedLabel, kUndefinedLabel);
+    std::vector<RegionLabel> backward(kUndefinedLabel, kUndefinedLabel);
+    std::size_t mismatches = 0;
+
+    for (std::size_t i = 0; i < labels->size(); ++i) {
+      RegionLabel updated = (*labels)[i];
+      RegionLabel fresh = rebuilt->coord_regions_[i];
+
+      if (updated == kUndefinedLabel || fresh == kUndefinedLabel) {
+        mismatches += updated != fresh;
+        continue;
+      }
+
+      if (forward[updated] == kUndefinedLabel && backward[fresh] == kUndefinedLabel) {
+        forward[updated] = fresh;
+        backward[fresh] = updated;
+      }
+
+      if (forward[updated] != fresh || backward[fresh] != updated) {
+        ++mismatches;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(rebuild_mutex_);
+
+    rebuild_mismatches_ = mismatches;
+    rebuild_running_ = false;
+    rebuild_done_.notify_all();
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(rebuild_mutex_);
+    rebuild_running_ = true;
+  }
+
+  rebuilding_ = true;
+
+  if (workers_ == nullptr) {
+    rebuild();
+    CollectRebuild();
+    return;
+  }
+
+  workers_->Submit(rebuild);
+}
+
+uint8_t RegionRegistry::GetCornerMask(const Map& map, uint16_t x, uint16_t y, float radius) const {
+  Vector2f position(x, y);
+  uint8_t mask = 0;
+
+  // Same order as the passes in FloodFillRegion.
+  if (map.CornerPointCheck(position, false, false, radius)) mask |= 1;
+  if (map.CornerPointCheck(position, false, true, radius)) mask |= 2;
+  if (map.CornerPointCheck(position, true, false, radius)) mask |= 4;
+  if (map.CornerPointCheck(position, true, true, radius)) mask |= 8;
+
+  return mask;
+}
+
+/*
+Opening a tile can only make more corner checks pass, so the tiles around it can only gain connections.  Each group of
+connected tiles around the change is flooded until it reaches tiles that already have a region.  Those regions are
+merged, and the tiles in the group that didn't have a region are added to it.
+
+Two tiles are connected when they are next to each other and pass the same corner check, which is the step that
+FloodFillEmptyRegion takes.
+*/
+void RegionRegistry::MergeRegions(const Map& map, int min_x, int min_y, int max_x, int max_y, float radius) {
+  uint32_t mark = BeginUpdate(1);
+  std::vector<uint32_t> queue;
+
+  for (int y = min_y; y <= max_y; ++y) {
+    for (int x = min_x; x <= max_x; ++x) {
+      uint32_t start = y * 1024 + x;
+
+      if (update_marks_[start] >= mark) continue;
+      if (GetCornerMask(map, x, y, radius) == 0) continue;
+
+      RegionLabel label = kUndefinedLabel;
+      bool occupiable = false;
+
+      queue.clear();
+      queue.push_back(start);
+      update_marks_[start] = mark;
+
+      for (std::size_t head = 0; head < queue.size(); ++head) {
+        uint32_t index = queue[head];
+        uint16_t tile_x = index % 1024;
+        uint16_t tile_y = index / 1024;
+        uint8_t mask = GetCornerMask(map, tile_x, tile_y, radius);
+        RegionLabel tile_label = coord_regions_[index];
+
+        if (tile_label != kUndefinedLabel) {
+          label = label == kUndefinedLabel ? GetRootLabel(tile_label) : MergeLabels(label, tile_label);
+        } else if (!occupiable) {
+          occupiable = map.CanOccupyRadius(Vector2f(tile_x, tile_y), radius);
+        }
+
+        const MapCoord neighbors[] = {MapCoord(tile_x - 1, tile_y), MapCoord(tile_x + 1, tile_y),
+                                      MapCoord(tile_x, tile_y - 1), MapCoord(tile_x, tile_y + 1)};
+
+        for (MapCoord neighbor : neighbors) {
+          if (!IsValidPosition(neighbor)) continue;
+
+          uint32_t neighbor_index = neighbor.y * 1024 + neighbor.x;
+
+          if (update_marks_[neighbor_index] >= mark) continue;
+          if (!(GetCornerMask(map, neighbor.x, neighbor.y, radius) & mask)) continue;
+
+          RegionLabel neighbor_label = coord_regions_[neighbor_index];
+          bool inside = neighbor.x >= min_x && neighbor.x <= max_x && neighbor.y >= min_y && neighbor.y <= max_y;
+
+          // The connections between tiles outside of the area didn't change, so a tile that already has a region
+          // only needs its region merged.
+          if (neighbor_label != kUndefinedLabel && !inside) {
+            label = label == kUndefinedLabel ? GetRootLabel(neighbor_label) : MergeLabels(label, neighbor_label);
+            continue;
+          }
+
+          update_marks_[neighbor_index] = mark;
+          queue.push_back(neighbor_index);
+        }
+      }
+
+      if (label == kUndefinedLabel) {
+        // CreateAll only starts regions on tiles that the ship fits on.
+        if (!occupiable) continue;
+
+        label = GetLabel(CreateRegion());
+      }
+
+      for (uint32_t index : queue) {
+        if (coord_regions_[index] == kUndefinedLabel) {
+          coord_regions_[index] = label;
+        }
+      }
+    }
+  }
+}
+
+/*
+Closing a tile can only remove connections, so a region that had tiles around the change might be split.  A flood is
+started from each tile around the change and the floods take turns expanding one tile at a time.  Floods that meet
+are joined.  Once only one group of floods is left, the rest of the region is still connected to it.  A group that
+runs out of tiles before that is cut off from the rest, so its tiles are moved to a new region.
+
+This means a split only floods the smaller side, and a change that doesn't split anything stops as soon as the floods
+around it meet.
+*/
+void RegionRegistry::SplitRegions(const Map& map, int min_x, int min_y, int max_x, int max_y, float radius) {
+  struct Flood {
+    RegionLabel label;
+    // The tiles that the flood visited. The ones past the head still need to be expanded.
+    std::vector<uint32_t> tiles;
+    std::size_t head;
+    std::size_t set;
+  };
+
+  std::vector<Flood> floods;
+
+  // The tiles that the ship no longer fits on in any orientation aren't part of a region.
+  for (int y = min_y; y <= max_y; ++y) {
+    for (int x = min_x; x <= max_x; ++x) {
+      if (GetCornerMask(map, x, y, radius) == 0) {
+        coord_regions_[y * 1024 + x] = kUndefinedLabel;
+      }
+    }
+  }
+
+  // The tiles just outside of the area lost their connections into it, so they are included.
+  for (int y = std::max(min_y - 1, 0); y <= std::min(max_y + 1, 1023); ++y) {
+    for (int x = std::max(min_x - 1, 0); x <= std::min(max_x + 1, 1023); ++x) {
+      RegionLabel label = coord_regions_[y * 1024 + x];
+
+      if (label == kUndefinedLabel) continue;
+
+      floods.push_back(Flood{GetRootLabel(label), {(uint32_t)(y * 1024 + x)}, 0, floods.size()});
+    }
+  }
+
+  if (floods.empty()) return;
+
+  uint32_t mark = BeginUpdate(floods.size());
+
+  for (std::size_t i = 0; i < floods.size(); ++i) {
+    update_marks_[floods[i].tiles[0]] = mark + (uint32_t)i;
+  }
+
+  auto find_set = [&floods](std::size_t flood) {
+    while (floods[flood].set != flood) {
+      flood = floods[flood].set = floods[floods[flood].set].set;
+    }
+    return flood;
+  };
+
+  // The number of separate groups for each region around the change.
+  std::unordered_map<RegionLabel, std::size_t> group_counts;
+
+  for (const Flood& flood : floods) {
+    ++group_counts[flood.label];
+  }
+
+  bool expanding = true;
+
+  while (expanding) {
+    expanding = false;
+
+    for (std::size_t i = 0; i < floods.size(); ++i) {
+      Flood& flood = floods[i];
+
+      if (flood.head >= flood.tiles.size() || group_counts[flood.label] <= 1) continue;
+
+      expanding = true;
+
+      uint32_t index = flood.tiles[flood.head++];
+      uint16_t tile_x = index % 1024;
+      uint16_t tile_y = index / 1024;
+      uint8_t mask = GetCornerMask(map, tile_x, tile_y, radius);
+
+      const MapCoord neighbors[] = {MapCoord(tile_x - 1, tile_y), MapCoord(tile_x + 1, tile_y),
+                                    MapCoord(tile_x, tile_y - 1), MapCoord(tile_x, tile_y + 1)};
+
+      for (MapCoord neighbor : neighbors) {
+        if (!IsValidPosition(neighbor)) continue;
+
+        uint32_t neighbor_index = neighbor.y * 1024 + neighbor.x;
+        RegionLabel neighbor_label = coord_regions_[neighbor_index];
+
+        if (neighbor_label == kUndefinedLabel || GetRootLabel(neighbor_label) != flood.label) continue;
+        if (!(GetCornerMask(map, neighbor.x, neighbor.y, radius) & mask)) continue;
+
+        uint32_t neighbor_mark = update_marks_[neighbor_index];
+
+        if (neighbor_mark >= mark) {
+          std::size_t first = find_set(i);
+          std::size_t second = find_set(neighbor_mark - mark);
+
+          if (first != second) {
+            floods[second].set = first;
+            --group_counts[flood.label];
+          }
+          continue;
+        }
+
+        update_marks_[neighbor_index] = mark + (uint32_t)i;
+        flood.tiles.push_back(neighbor_index);
+      }
+
+      if (flood.head < flood.tiles.size()) continue;
+
+      // The group is cut off once every flood in it has run out of tiles.
+      std::size_t set = find_set(i);
+      bool finished = true;
+
+      for (std::size_t j = 0; j < floods.size() && finished; ++j) {
+        if (find_set(j) == set && floods[j].head < floods[j].tiles.size()) {
+          finished = false;
+        }
+      }
+
+      if (!finished) continue;
+
+      RegionIndex region_index = CreateRegion();
+
+      // There are no labels left, so the group stays connected to the rest of the region.
+      if (GetLabel(region_index) == kUndefinedLabel) continue;
+
+      for (std::size_t j = 0; j < floods.size(); ++j) {
+        if (find_set(j) != set) continue;
+
+        for (uint32_t tile : floods[j].tiles) {
+          coord_regions_[tile] = GetLabel(region_index);
         }
       }
+
+      --group_counts[flood.label];
     }
+  }
+}
+
+// The outside edges are only patched around the change until the rebuild replaces them. A closed tile becomes an
+// edge if it touches an edge, and an opened tile stops being one if a ship fits on it.
+void RegionRegistry::UpdateEdges(const Map& map, MapCoord coord) {
+  // CanOccupy with a radius of 0.8 uses the tiles within one tile.
+  int min_x = std::max(coord.x - 2, 0);
+  int min_y = std::max(coord.y - 2, 0);
+  int max_x = std::min(coord.x + 2, 1023);
+  int max_y = std::min(coord.y + 2, 1023);
+
+  if (!map.IsSolid(coord.x, coord.y)) {
+    for (int y = min_y; y <= max_y; ++y) {
+      for (int x = min_x; x <= max_x; ++x) {
+        if (map.CanOccupy(Vector2f(x, y), 0.8f)) {
+          ClearEdge(y * 1024 + x);
+        }
+      }
+    }
+    return;
+  }
+
+  // Spread the edge from the tiles around the area that were already edges.
+  for (int pass = 0; pass < 3; ++pass) {
+    for (int y = min_y; y <= max_y; ++y) {
+      for (int x = min_x; x <= max_x; ++x) {
+        if (IsEdge(MapCoord(x, y)) || map.CanOccupy(Vector2f(x, y), 0.8f)) continue;
+
+        for (int i = 0; i < 9; ++i) {
+          MapCoord neighbor(x + i % 3 - 1, y + i / 3 - 1);
+
+          if (IsValidPosition(neighbor) && IsEdge(neighbor)) {
+            SetEdge(y * 1024 + x);
+            break;
+          }
+        }
+      }
+    }
+  }
+}
+
+uint32_t RegionRegistry::BeginUpdate(std::size_t count) {
+  if (update_marks_.empty() || update_generation_ + count + 1 < update_generation_) {
+    update_marks_.assign(1024 * 1024, 0);
+    update_generation_ = 0;
+  }
+
+  uint32_t mark = update_generation_ + 1;
+
+  update_generation_ += (uint32_t)count;
+
+  return mark;
+}
+
+RegionRegistry::RegionLabel RegionRegistry::MergeLabels(RegionLabel first, RegionLabel second) {
+  first = GetRootLabel(first);
+  second = GetRootLabel(second);
+
+  if (first == second) return first;
+
+  RegionLabel root = std::min(first, second);
+  RegionLabel merged = std::max(first, second);
+
+  if (label_roots_.size() <= merged) {
+    std::size_t size = label_roots_.size();
+
+    label_roots_.resize(merged + 1);
+
+    for (std::size_t i = size; i < label_roots_.size(); ++i) {
+      label_roots_[i] = (RegionLabel)i;
+    }
+  }
+
+  // The roots are kept flat so a lookup is a single step.
+  for (RegionLabel& label : label_roots_) {
+    if (label == merged) {
+      label = root;
+    }
+  }
+
+  return root;
+}
+
+void RegionRegistry::DebugUpdate(Vector2f position) {
+
+    RegionIndex index = GetRegionIndex(position);
 
   for (uint16_t y = 0; y < 1024; ++y) {
     for (uint16_t x = 0; x < 1024; ++x) {
-      if (index != -1 && outside_edges_[y * 1024 + x] == index) {
+      // The edges aren't stored by region, so this shows the edges of every region.
+      if (index != kUndefinedRegion && IsEdge(MapCoord(x, y))) {
         Vector2f check = Vector2f(x, y);
          RenderWorldLine(position, check, check + Vector2f(1, 1), RGB(255, 255, 255));
          RenderWorldLine(position, check + Vector2f(0, 1), check + Vector2f(1, 0), RGB(255, 255, 255));
@@ -383,7 +1057,7 @@ void RegionRegistry::DebugUpdate(Vector2f position) {
   }
   for (uint16_t y = 0; y < 1024; ++y) {
     for (uint16_t x = 0; x < 1024; ++x) {
-      if (index != -1 && coord_regions_ [y * 1024 + x] == index) {
+      if (index != kUndefinedRegion && GetRootLabel(coord_regions_[y * 1024 + x]) == index) {
         Vector2f check = Vector2f(x,y);
         //RenderWorldLine(position, check, check + Vector2f(1, 1), RGB(255, 255, 255));
         //RenderWorldLine(position, check + Vector2f(0, 1), check + Vector2f(1, 0), RGB(255, 255, 255));
@@ -399,16 +1073,20 @@ void RegionRegistry::DebugUpdate(Vector2f position) {
 bool RegionRegistry::IsRegistered(MapCoord coord) const {
  // return coord_regions_.find(coord) != coord_regions_.end();
   if (!IsValidPosition(Vector2f(coord.x, coord.y))) return false;
-  return coord_regions_[coord.y * 1024 + coord.x] != -1;
+  return coord_regions_[coord.y * 1024 + coord.x] != kUndefinedLabel;
 }
 
 void RegionRegistry::Insert(MapCoord coord, RegionIndex index) {
   //coord_regions_[coord] = index;
   if (!IsValidPosition(Vector2f(coord.x, coord.y))) return;
-  coord_regions_[coord.y * 1024 + coord.x] = index;
+  coord_regions_[coord.y * 1024 + coord.x] = GetLabel(index);
 }
 
 RegionIndex RegionRegistry::CreateRegion() {
+  if (region_count_ == kMaxRegions) {
+    debug_log << "Region limit of " << kMaxRegions << " reached. Later regions won't be connected." << std::endl;
+  }
+
   return region_count_++;
 }
 
@@ -416,7 +1094,8 @@ RegionIndex RegionRegistry::GetRegionIndex(MapCoord coord) {
   //auto itr = coord_regions_.find(coord);
   //return itr->second;
   if (!IsValidPosition(Vector2f(coord.x, coord.y))) return -1;
-  return coord_regions_[coord.y * 1024 + coord.x];
+  RegionLabel label = coord_regions_[coord.y * 1024 + coord.x];
+  return label == kUndefinedLabel ? kUndefinedRegion : GetRootLabel(label);
 }
 
 bool RegionRegistry::IsConnected(MapCoord a, MapCoord b) const {
@@ -427,11 +1106,11 @@ bool RegionRegistry::IsConnected(MapCoord a, MapCoord b) const {
   if (!IsValidPosition(Vector2f(a.x, a.y))) return false;
   if (!IsValidPosition(Vector2f(b.x, b.y))) return false;
 
-RegionIndex first = coord_regions_[a.y * 1024 + a.x];
-  if (first == -1) return false;
+  RegionLabel first = GetRootLabel(coord_regions_[a.y * 1024 + a.x]);
+  if (first == kUndefinedLabel) return false;
 
   //auto second = coord_regions_.find(b);
-  RegionIndex second = coord_regions_[b.y * 1024 + b.x];
+  RegionLabel second = GetRootLabel(coord_regions_[b.y * 1024 + b.x]);
 
   //return first->second == second->second;
   return first == second;
@@ -440,11 +1119,62 @@ RegionIndex first = coord_regions_[a.y * 1024 + a.x];
 bool RegionRegistry::IsEdge(MapCoord coord) const {
   //return outside_edges_.find(coord) != outside_edges_.end();
   if (!IsValidPosition(Vector2f(coord.x, coord.y))) return true;
-  return outside_edges_[coord.y * 1024 + coord.x] != -1;
+  std::size_t index = coord.y * 1024 + coord.x;
+  return (outside_edges_[index / 64] >> (index % 64)) & 1;
 }
 
 bool IsValidPosition(MapCoord coord) {
   return coord.x >= 0 && coord.x < 1024 && coord.y >= 0 && coord.y < 1024;
 }
 
+void RegionRegistry::Save(CacheWriter& writer) const {
+  writer.Write(region_count_);
+
+  if (label_roots_.empty()) {
+    writer.WriteArray(coord_regions_.data(), 1024 * 1024);
+  } else {
+    // Store the merged labels so the roots don't need to be saved.
+    std::vector<RegionLabel> labels(1024 * 1024);
+
+    for (std::size_t i = 0; i < labels.size(); ++i) {
+      labels[i] = GetRootLabel(coord_regions_[i]);
+    }
+
+    writer.WriteArray(labels.data(), labels.size());
+  }
+
+  writer.WriteArray(unordered_solids_.data(), 1024 * 1024);
+  writer.WriteArray(outside_edges_.data(), 1024 * 1024 / 64);
+
+  writer.Write((uint32_t)seed_fills_.size());
+
+  for (const SeedFill& fill : seed_fills_) {
+    writer.WriteVector(fill.points);
+    writer.Write(fill.radius);
+  }
+}
+
+bool RegionRegistry::Load(CacheReader& reader) {
+  label_roots_.clear();
+  seed_fills_.clear();
+
+  if (!reader.Read(region_count_) || !reader.ReadArray(coord_regions_.data(), 1024 * 1024) ||
+      !reader.ReadArray(unordered_solids_.data(), 1024 * 1024) ||
+      !reader.ReadArray(outside_edges_.data(), 1024 * 1024 / 64)) {
+    return false;
+  }
+
+  uint32_t fill_count = 0;
+
+  if (!reader.Read(fill_count)) return false;
+
+  seed_fills_.resize(fill_count);
+
+  for (SeedFill& fill : seed_fills_) {
+    if (!reader.ReadVector(fill.points) || !reader.Read(fill.radius)) return false;
+  }
+
+  return true;
+}
+
 }  // namespace marvin
@@ -1,10 +1,13 @@
 #pragma once
 
+#include <condition_variable>
 #include <cstdint>
 #include <cstdlib>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 #include "Hash.h"
 #include "Vector2f.h"
@@ -13,7 +16,10 @@
 
 namespace marvin {
 
+class CacheReader;
+class CacheWriter;
 class Map;
+class WorkerPool;
 
 using RegionIndex = std::size_t;
 
@@ -39,20 +45,51 @@ namespace marvin {
 
 class RegionRegistry {
  public:
-  RegionRegistry(const Map& map) : region_count_(0) { 
-	memset(coord_regions_, 0xFF, sizeof(coord_regions_));
-    memset(unordered_solids_, 0xFF, sizeof(unordered_solids_));
-    memset(outside_edges_, 0xFF, sizeof(outside_edges_));
-  }
+  RegionRegistry(const Map& map)
+      : map_(map),
+        region_count_(0),
+        coord_regions_(1024 * 1024, kUndefinedLabel),
+        unordered_solids_(1024 * 1024, kUndefinedLabel),
+        outside_edges_(1024 * 1024 / 64, 0) {}
+  // Waits for the rebuild that is running since the workers write into the registry.
+  ~RegionRegistry();
 
   bool IsConnected(MapCoord a, MapCoord b) const;
   bool IsEdge(MapCoord coord) const;
 
   void CreateAll(const Map& map, float radius);
+  // Fills a region from each seed. Calling it again with the same seeds and radius does nothing, so the zones can
+  // call it after the regions were loaded from the map cache.
   void CreateRegions(const Map& map, std::vector<Vector2f> seed_points, float radius);
+  // Updates the regions around a tile that changed between solid and open. Opening a tile merges the regions that
+  // it connects and closing one splits a region if the tile was its only connection. Only the tiles around the
+  // change and the smaller side of a split are flooded, and the outside edges are patched around the change.
+  // With DEBUG_CHECK_REGION_UPDATES set, the whole map is also rebuilt on the workers and the labels are checked
+  // against the update.
+  void UpdateTile(const Map& map, MapCoord coord, float radius);
+  // Checks the result of the rebuild once the workers finish it. This needs to be called every frame.
+  void CollectRebuild();
+  // Without workers the check rebuild runs before UpdateTile returns.
+  void SetWorkerPool(WorkerPool* workers) { workers_ = workers; }
 
   void DebugUpdate(Vector2f position);
 
+  void Save(CacheWriter& writer) const;
+  bool Load(CacheReader& reader);
+
+  // Regions are stored as 16 bit labels. Regions past kMaxRegions are logged and treated as not connected to
+  // anything. The labels above that mark tiles while a region is being filled, so they never belong to a region.
+  using RegionLabel = uint16_t;
+  constexpr static RegionLabel kUndefinedLabel = 0xFFFF;
+  // The solids that a region's outside edge fill already visited.
+  constexpr static RegionLabel kConsumedSolidLabel = 0xFFFE;
+  // The four corner passes of FloodFillRegion use the labels from here up.
+  constexpr static RegionLabel kFillPassLabel = 0xFFFA;
+  constexpr static RegionIndex kMaxRegions = 0xFFF0;
+
+  static_assert(kFillPassLabel + 4 <= kConsumedSolidLabel, "The fill pass labels overlap the consumed solid label.");
+  static_assert(kMaxRegions <= kFillPassLabel, "Region labels overlap the fill labels.");
+
  private:
   bool IsRegistered(MapCoord coord) const;
   void Insert(MapCoord coord, RegionIndex index);
@@ -61,14 +98,68 @@ class RegionRegistry {
   RegionIndex CreateRegion();
 
   void FloodFillRegion(const Map& map, const MapCoord& coord, RegionIndex region_index, float radius);
-  void FloodFillEmptyRegion(const Map& map, const MapCoord& coord, RegionIndex region_index, bool right_corner_check,
+  void FloodFillEmptyRegion(const Map& map, const MapCoord& coord, RegionLabel label, bool right_corner_check,
                             bool bottom_corner_check, float radius);
   void FloodFillSolidRegion(const Map& map, const MapCoord& coord, RegionIndex region_index);
 
+  // One bit for each of the corner checks that FloodFillRegion does that pass on the tile.
+  uint8_t GetCornerMask(const Map& map, uint16_t x, uint16_t y, float radius) const;
+  void MergeRegions(const Map& map, int min_x, int min_y, int max_x, int max_y, float radius);
+  void SplitRegions(const Map& map, int min_x, int min_y, int max_x, int max_y, float radius);
+  void UpdateEdges(const Map& map, MapCoord coord);
+  // Builds the regions again from a copy of the map to check the updates. Tiles where the updated labels disagree
+  // with the rebuilt ones are counted and logged when the rebuild is collected. The rebuild is never swapped in.
+  void StartRebuild(float radius);
+  // Starts the marks for an update that floods from count sources. Returns the mark of the first source.
+  uint32_t BeginUpdate(std::size_t count);
+
+  RegionLabel GetRootLabel(RegionLabel label) const {
+    return label < label_roots_.size() ? label_roots_[label] : label;
+  }
+  // Returns the root of the merged region.
+  RegionLabel MergeLabels(RegionLabel first, RegionLabel second);
+
+  static RegionLabel GetLabel(RegionIndex index) {
+    return index < kMaxRegions ? (RegionLabel)index : kUndefinedLabel;
+  }
+
+  void SetEdge(std::size_t index) { outside_edges_[index / 64] |= 1ULL << (index % 64); }
+  void ClearEdge(std::size_t index) { outside_edges_[index / 64] &= ~(1ULL << (index % 64)); }
+
+  const Map& map_;
   RegionIndex region_count_;
 
-  RegionIndex coord_regions_[1024 * 1024];
-  RegionIndex unordered_solids_[1024 * 1024];
-  RegionIndex outside_edges_[1024 * 1024];
+  // These are sized for the whole map when the registry is created and never resized.
+  std::vector<RegionLabel> coord_regions_;
+  // The region that first touched each solid tile. CreateRegions continues from the solids that CreateAll left, so
+  // they are kept and cached along with the labels.
+  std::vector<RegionLabel> unordered_solids_;
+  // One bit for each tile that is on the outside edge of a region.
+  std::vector<uint64_t> outside_edges_;
+
+  // The label that each label was merged into by UpdateTile. Labels past the end were never merged.
+  std::vector<RegionLabel> label_roots_;
+  // The flood that visited each tile during an update. Marks below the current update's first mark are old.
+  std::vector<uint32_t> update_marks_;
+  uint32_t update_generation_ = 0;
+
+  struct SeedFill {
+    std::vector<Vector2f> points;
+    float radius;
+  };
+
+  // The calls to CreateRegions, so rebuilds can fill the same seeds again. They're saved with the labels.
+  std::vector<SeedFill> seed_fills_;
+
+  WorkerPool* workers_ = nullptr;
+  float rebuild_radius_ = 0.0f;
+  // Set when a rebuild is running, and when the tiles changed after it started. Only used by the owning thread.
+  bool rebuilding_ = false;
+  bool rebuild_stale_ = false;
+  // The result of the rebuild that the workers finished and whether one is running, guarded by the mutex.
+  std::size_t rebuild_mismatches_ = 0;
+  bool rebuild_running_ = false;
+  std::mutex rebuild_mutex_;
+  std::condition_variable rebuild_done_;
 };
 }  // namespace marvin
@@ -0,0 +1,65 @@
+#include "TaskGraph.h"
+
+#include "Time.h"
+
+namespace marvin {
+
+TaskId TaskGraph::Add(const std::string& name, std::function<void()> function,
+                      const std::vector<TaskId>& dependencies) {
+  TaskId id = tasks_.size();
+
+  tasks_.emplace_back();
+
+  Task& task = tasks_.back();
+
+  task.name = name;
+  task.function = std::move(function);
+  task.dependency_count = dependencies.size();
+
+  for (TaskId dependency : dependencies) {
+    tasks_[dependency].dependents.push_back(id);
+  }
+
+  return id;
+}
+
+void TaskGraph::Run(WorkerPool& pool) {
+  finished_count_ = 0;
+  remaining_.resize(tasks_.size());
+
+  for (TaskId id = 0; id < tasks_.size(); ++id) {
+    remaining_[id] = tasks_[id].dependency_count;
+  }
+
+  for (TaskId id = 0; id < tasks_.size(); ++id) {
+    if (tasks_[id].dependency_count == 0) {
+      Submit(pool, id);
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  finished_.wait(lock, [this]() { return finished_count_ == tasks_.size(); });
+}
+
+void TaskGraph::Submit(WorkerPool& pool, TaskId id) {
+  pool.Submit([this, &pool, id]() {
+    Task& task = tasks_[id];
+    PerformanceTimer timer;
+
+    task.function();
+    task.elapsed = timer.GetElapsedTime();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    for (TaskId dependent : task.dependents) {
+      if (--remaining_[dependent] == 0) {
+        Submit(pool, dependent);
+      }
+    }
+
+    ++finished_count_;
+    finished_.notify_all();
+  });
+}
+
+}  // namespace marvin
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Types.h"
+#include "WorkerPool.h"
+
+namespace marvin {
+
+using TaskId = std::size_t;
+
+// Set of tasks with explicit dependencies. Each task is submitted to the worker pool as soon as all of the tasks that
+// it depends on are finished, so tasks that don't depend on each other run at the same time.
+class TaskGraph {
+ public:
+  struct Task {
+    std::string name;
+    std::function<void()> function;
+    std::vector<TaskId> dependents;
+    std::size_t dependency_count = 0;
+    // Wall time of the task in microseconds after the graph has run.
+    u64 elapsed = 0;
+  };
+
+  // Dependencies need to be added before the tasks that depend on them.
+  TaskId Add(const std::string& name, std::function<void()> function, const std::vector<TaskId>& dependencies = {});
+
+  // Runs every task and blocks until all of them are finished. This must not be called from a job on the same pool.
+  void Run(WorkerPool& pool);
+
+  const std::vector<Task>& GetTasks() const { return tasks_; }
+
+ private:
+  void Submit(WorkerPool& pool, TaskId id);
+
+  std::vector<Task> tasks_;
+  std::vector<std::size_t> remaining_;
+  std::size_t finished_count_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable finished_;
+};
+
+}  // namespace marvin
@@ -0,0 +1,62 @@
+#include "WorkerPool.h"
+
+namespace marvin {
+
+WorkerPool::WorkerPool(std::size_t thread_count) {
+  if (thread_count == 0) {
+    thread_count = std::thread::hardware_concurrency();
+  }
+
+  if (thread_count == 0) {
+    thread_count = 1;
+  }
+
+  for (std::size_t i = 0; i < thread_count; ++i) {
+    threads_.emplace_back(&WorkerPool::Run, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+
+  condition_.notify_all();
+
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void WorkerPool::Submit(Job job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(std::move(job));
+  }
+
+  condition_.notify_one();
+}
+
+void WorkerPool::Run() {
+  while (true) {
+    Job job;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+
+      condition_.wait(lock, [this]() { return stopping_ || !jobs_.empty(); });
+
+      // The queue is drained before the pool is destroyed. The owners of the jobs wait for them to finish, so a job
+      // that was dropped would leave its owner waiting forever.
+      if (jobs_.empty()) return;
+
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+
+    job();
+  }
+}
+
+}  // namespace marvin
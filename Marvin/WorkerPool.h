@@ -0,0 +1,36 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace marvin {
+
+// Fixed set of threads that run submitted jobs in the order they were submitted.
+class WorkerPool {
+ public:
+  using Job = std::function<void()>;
+
+  // Creates one thread for each hardware thread when the count is zero.
+  WorkerPool(std::size_t thread_count = 0);
+  // Runs the jobs that are still queued before the threads stop.
+  ~WorkerPool();
+
+  void Submit(Job job);
+
+  std::size_t GetThreadCount() const { return threads_.size(); }
+
+ private:
+  void Run();
+
+  std::vector<std::thread> threads_;
+  std::deque<Job> jobs_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool stopping_ = false;
+};
+
+}  // namespace marvin
@@ -0,0 +1,464 @@
+#pragma once
+
+#include <random>
+#include <unordered_set>
+
+#include "../Bot.h"
+#include "../Debug.h"
+#include "../RegionRegistry.h"
+#include "../Time.h"
+#include "../path/DistanceField.h"
+#include "CommandSystem.h"
+
+namespace marvin {
+
+// Creates one of the generated maps that the benchmarks can run on instead of the current map. The seeds are fixed
+// so every build benchmarks the same maps. Returns nullptr if the name isn't one of open, rocks or maze.
+inline std::unique_ptr<Map> CreateBenchmarkMap(const std::string& name) {
+  constexpr TileId kSolidTileId = 1;
+  constexpr int kExtent = (int)kMapExtent;
+
+  TileData tiles(kMapExtent * kMapExtent, 0);
+  std::mt19937 rng(1024);
+
+  if (name == "open" || name == "rocks") {
+    for (int i = 0; i < kExtent; ++i) {
+      tiles[i] = tiles[(kExtent - 1) * kExtent + i] = kSolidTileId;
+      tiles[i * kExtent] = tiles[i * kExtent + kExtent - 1] = kSolidTileId;
+    }
+
+    if (name == "rocks") {
+      // Small rocks cover about a third of the map so searches have to weave around walls the whole way.
+      std::uniform_int_distribution<int> position_dist(1, kExtent - 2);
+      std::uniform_int_distribution<int> size_dist(1, 8);
+
+      for (int i = 0; i < 25000; ++i) {
+        int rock_x = position_dist(rng);
+        int rock_y = position_dist(rng);
+        int width = size_dist(rng);
+        int height = size_dist(rng);
+
+        for (int y = rock_y; y < std::min(rock_y + height, kExtent - 1); ++y) {
+          for (int x = rock_x; x < std::min(rock_x + width, kExtent - 1); ++x) {
+            tiles[y * kExtent + x] = kSolidTileId;
+          }
+        }
+      }
+    }
+  } else if (name == "maze") {
+    // A perfect maze of 6 tile wide corridors with 2 tile walls, carved with a depth first search over the cells.
+    constexpr int kCellSize = 8;
+    constexpr int kCells = kExtent / kCellSize;
+
+    std::fill(tiles.begin(), tiles.end(), kSolidTileId);
+
+    auto carve = [&tiles](int min_x, int min_y, int max_x, int max_y) {
+      for (int y = min_y; y < max_y; ++y) {
+        for (int x = min_x; x < max_x; ++x) {
+          tiles[y * kExtent + x] = 0;
+        }
+      }
+    };
+
+    std::vector<bool> visited(kCells * kCells, false);
+    std::vector<int> stack(1, 0);
+
+    visited[0] = true;
+    carve(1, 1, kCellSize - 1, kCellSize - 1);
+
+    while (!stack.empty()) {
+      int cell = stack.back();
+      int cell_x = cell % kCells;
+      int cell_y = cell / kCells;
+      int neighbors[4];
+      int neighbor_count = 0;
+
+      if (cell_x > 0 && !visited[cell - 1]) neighbors[neighbor_count++] = cell - 1;
+      if (cell_x < kCells - 1 && !visited[cell + 1]) neighbors[neighbor_count++] = cell + 1;
+      if (cell_y > 0 && !visited[cell - kCells]) neighbors[neighbor_count++] = cell - kCells;
+      if (cell_y < kCells - 1 && !visited[cell + kCells]) neighbors[neighbor_count++] = cell + kCells;
+
+      if (neighbor_count == 0) {
+        stack.pop_back();
+        continue;
+      }
+
+      int next = neighbors[std::uniform_int_distribution<int>(0, neighbor_count - 1)(rng)];
+      int min_x = std::min(cell_x, next % kCells) * kCellSize;
+      int min_y = std::min(cell_y, next / kCells) * kCellSize;
+      int max_x = (std::max(cell_x, next % kCells) + 1) * kCellSize;
+      int max_y = (std::max(cell_y, next / kCells) + 1) * kCellSize;
+
+      // Carving the box around both cells opens the wall between them.
+      carve(min_x + 1, min_y + 1, max_x - 1, max_y - 1);
+
+      visited[next] = true;
+      stack.push_back(next);
+    }
+  } else {
+    return nullptr;
+  }
+
+  return std::make_unique<Map>(tiles);
+}
+
+// Runs a fixed set of random path searches on the current map, or on a generated map when one is named, and reports
+// the time and expanded nodes per search for A* and for jump point search. The seed is fixed so the same queries are
+// used between builds.
+class PathBenchmarkCommand : public CommandExecutor {
+ public:
+  void Execute(CommandSystem& cmd, Bot& bot, const std::string& sender, const std::string& arg) override {
+    GameProxy& game = bot.GetGame();
+    float radius = game.GetShipSettings().GetRadius();
+
+    std::vector<std::string> args = Tokenize(arg, ' ');
+    int count = 100;
+    std::string map_name;
+
+    for (const std::string& token : args) {
+      if (token.empty()) continue;
+
+      if (std::isdigit(token[0])) {
+        count = atoi(token.c_str());
+      } else {
+        map_name = token;
+      }
+    }
+
+    if (count <= 0) {
+      count = 100;
+    }
+
+    if (map_name.empty()) {
+      Run(game, sender, game.GetMapFile(), game.GetMap(), bot.GetRegions(), bot.GetPathfinder(), radius, count);
+      return;
+    }
+
+    std::unique_ptr<Map> map = CreateBenchmarkMap(map_name);
+
+    if (!map) {
+      game.SendPrivateMessage(sender, "Unknown map. Use open, rocks or maze.");
+      return;
+    }
+
+    auto regions = std::make_unique<RegionRegistry>(*map);
+    path::Pathfinder pathfinder(std::make_unique<path::NodeProcessor>(game, *map), *regions);
+
+    regions->CreateAll(*map, radius);
+    pathfinder.CreateMapWeights(*map);
+    pathfinder.SetPathableNodes(*map, radius);
+
+    Run(game, sender, map_name, *map, *regions, pathfinder, radius, count);
+  }
+
+  CommandAccessFlags GetAccess(Bot& bot) { return CommandAccess_Private; }
+  CommandFlags GetFlags() { return CommandFlag_Lockable; }
+  std::vector<std::string> GetAliases() { return {"pathbench"}; }
+  std::string GetDescription() { return "Times A* and jump point path searches on the current map or a generated map"; }
+  int GetSecurityLevel() { return 5; }
+
+ private:
+  void Run(GameProxy& game, const std::string& sender, const std::string& name, const Map& map,
+           RegionRegistry& regions, path::Pathfinder& pathfinder, float radius, int count) {
+    std::mt19937 rng(1024);
+    std::uniform_int_distribution<int> coord_dist(0, 1023);
+    std::vector<std::pair<Vector2f, Vector2f>> queries;
+
+    // Only pick pairs that are connected so the searches aren't rejected early.
+    for (int attempts = 0; (int)queries.size() < count && attempts < count * 1000; ++attempts) {
+      Vector2f from((float)coord_dist(rng), (float)coord_dist(rng));
+      Vector2f to((float)coord_dist(rng), (float)coord_dist(rng));
+
+      if (!map.CanPathOn(from, radius) || !map.CanPathOn(to, radius)) continue;
+      if (!regions.IsConnected(from, to)) continue;
+
+      queries.emplace_back(from + Vector2f(0.5f, 0.5f), to + Vector2f(0.5f, 0.5f));
+    }
+
+    if (queries.empty()) {
+      game.SendPrivateMessage(sender, "No pathable tiles found.");
+      return;
+    }
+
+    count = (int)queries.size();
+
+    // Both modes run the same queries so their expansions and times can be compared directly.
+    const path::SearchMode modes[] = {path::SearchMode::AStar, path::SearchMode::JumpPoint};
+    const char* mode_names[] = {"A*", "JPS"};
+
+    for (std::size_t i = 0; i < 2; ++i) {
+      std::string message = RunMode(map, pathfinder, queries, radius, modes[i], mode_names[i]);
+
+      debug_log << name << " " << message << std::endl;
+      game.SendPrivateMessage(sender, message);
+    }
+  }
+
+  // The reset time is what clearing the nodes that each search touched through a hash set, as FindPath did before
+  // the generation stamps, would have added to the search. It's measured separately so it doesn't change the search.
+  std::string RunMode(const Map& map, path::Pathfinder& pathfinder,
+                      const std::vector<std::pair<Vector2f, Vector2f>>& queries, float radius, path::SearchMode mode,
+                      const char* mode_name) {
+    // Clear the cache so each mode searches every query instead of reading the paths of the last run.
+    pathfinder.GetPathCache().Clear();
+
+    int count = (int)queries.size();
+    path::NodeProcessor& processor = pathfinder.GetProcessor();
+    std::size_t nodes_expanded = 0;
+    std::size_t heap_operations = 0;
+    std::size_t nodes_touched = 0;
+    u64 search_time = 0;
+    u64 reset_time = 0;
+    PerformanceTimer timer;
+    std::vector<path::Node*> touched;
+
+    for (const auto& query : queries) {
+      timer.GetElapsedTime();
+      pathfinder.FindPath(map, std::vector<Vector2f>(), query.first, query.second, radius, mode);
+      search_time += timer.GetElapsedTime();
+
+      const path::SearchStats& stats = pathfinder.GetSearchStats();
+
+      nodes_expanded += stats.nodes_expanded;
+      heap_operations += stats.heap_pushes + stats.heap_pops + stats.heap_updates;
+
+      touched.clear();
+
+      for (u16 y = 0; y < 1024; ++y) {
+        for (u16 x = 0; x < 1024; ++x) {
+          path::NodePoint point(x, y);
+
+          if (processor.IsTouched(point)) {
+            touched.push_back(processor.GetNode(point));
+          }
+        }
+      }
+
+      nodes_touched += touched.size();
+      timer.GetElapsedTime();
+
+      std::unordered_set<path::Node*> touched_set;
+
+      for (path::Node* node : touched) {
+        touched_set.insert(node);
+      }
+
+      for (path::Node* node : touched_set) {
+        node->ClearFlag(path::NodeFlag_Openset | path::NodeFlag_Closed);
+      }
+
+      reset_time += timer.GetElapsedTime();
+    }
+
+    char message[256];
+    sprintf(message,
+            "%s Paths: %d  Time per path: %lluus  Touched set reset per path: %lluus  Nodes per path: %zu  "
+            "Touched per path: %zu  Heap ops per path: %zu",
+            mode_name, count, search_time / count, reset_time / count, nodes_expanded / count, nodes_touched / count,
+            heap_operations / count);
+
+    return message;
+  }
+};
+
+// Reports the path cache counters. An optional argument sets the cache capacity so it can be tuned for each zone.
+class PathCacheCommand : public CommandExecutor {
+ public:
+  void Execute(CommandSystem& cmd, Bot& bot, const std::string& sender, const std::string& arg) override {
+    GameProxy& game = bot.GetGame();
+    path::PathCache& cache = bot.GetPathfinder().GetPathCache();
+
+    if (!arg.empty() && std::isdigit(arg[0])) {
+      cache.SetCapacity((std::size_t)atoi(arg.c_str()));
+      cache.ResetCounters();
+    }
+
+    std::size_t lookups = cache.GetHits() + cache.GetMisses();
+    float hit_rate = lookups > 0 ? cache.GetHits() * 100.0f / lookups : 0.0f;
+
+    char message[256];
+    sprintf(message, "Path cache hits: %zu  Misses: %zu  Hit rate: %.1f%%  Paths: %zu/%zu", cache.GetHits(),
+            cache.GetMisses(), hit_rate, cache.GetSize(), cache.GetCapacity());
+
+    debug_log << game.GetMapFile() << " " << message << std::endl;
+    game.SendPrivateMessage(sender, message);
+  }
+
+  CommandAccessFlags GetAccess(Bot& bot) { return CommandAccess_Private; }
+  CommandFlags GetFlags() { return CommandFlag_Lockable; }
+  std::vector<std::string> GetAliases() { return {"pathcache"}; }
+  std::string GetDescription() { return "Shows the path cache hit rate or sets its capacity"; }
+  int GetSecurityLevel() { return 5; }
+};
+
+
+// Times the wall distance scan that the map weights used to be created with against the distance field, and counts
+// the tiles where the two would create different weights. Runs on the current map, or on a generated map when one is
+// named.
+class WeightBenchmarkCommand : public CommandExecutor {
+ public:
+  void Execute(CommandSystem& cmd, Bot& bot, const std::string& sender, const std::string& arg) override {
+    GameProxy& game = bot.GetGame();
+    std::unique_ptr<Map> generated_map;
+    std::string name = game.GetMapFile();
+
+    if (!arg.empty()) {
+      generated_map = CreateBenchmarkMap(arg);
+
+      if (!generated_map) {
+        game.SendPrivateMessage(sender, "Unknown map. Use open, rocks or maze.");
+        return;
+      }
+
+      name = arg;
+    }
+
+    const Map& map = generated_map ? *generated_map : game.GetMap();
+    constexpr u16 kCloseDistance = 8;
+
+    PerformanceTimer timer;
+    std::vector<float> scan_distances(1024 * 1024, (float)kCloseDistance);
+
+    for (u16 y = 0; y < 1024; ++y) {
+      for (u16 x = 0; x < 1024; ++x) {
+        if (map.IsSolid(x, y)) continue;
+
+        scan_distances[(size_t)y * 1024 + x] = path::Pathfinder::GetWallDistance(map, x, y, kCloseDistance);
+      }
+    }
+
+    u64 scan_time = timer.GetElapsedTime();
+    std::vector<float> field = path::CreateWallDistanceField(map);
+    u64 field_time = timer.GetElapsedTime();
+
+    std::size_t mismatches = 0;
+
+    for (u16 y = 0; y < 1024; ++y) {
+      for (u16 x = 0; x < 1024; ++x) {
+        if (map.IsSolid(x, y)) continue;
+
+        size_t index = (size_t)y * 1024 + x;
+        float scan = std::min(scan_distances[index], (float)kCloseDistance);
+        float exact = std::min(std::sqrt(field[index]), (float)kCloseDistance);
+
+        if (scan != exact) {
+          ++mismatches;
+        }
+      }
+    }
+
+    char message[256];
+    sprintf(message, "Wall scan: %lluus  Distance field: %lluus  Mismatched weights: %zu", scan_time, field_time,
+            mismatches);
+
+    debug_log << name << " " << message << std::endl;
+    game.SendPrivateMessage(sender, message);
+  }
+
+  CommandAccessFlags GetAccess(Bot& bot) { return CommandAccess_Private; }
+  CommandFlags GetFlags() { return CommandFlag_Lockable; }
+  std::vector<std::string> GetAliases() { return {"weightbench"}; }
+  std::string GetDescription() { return "Times the map weight calculations on the current map or a generated map"; }
+  int GetSecurityLevel() { return 5; }
+};
+
+// Times nearest node searches around a 500 node path. Each result is checked against a linear scan of the path for
+// the first node on the same tile.
+class NodeSearchBenchmarkCommand : public CommandExecutor {
+ public:
+  void Execute(CommandSystem& cmd, Bot& bot, const std::string& sender, const std::string& arg) override {
+    GameProxy& game = bot.GetGame();
+    const Map& map = game.GetMap();
+    float radius = game.GetShipSettings().GetRadius();
+    constexpr std::size_t kPathNodes = 500;
+
+    int count = 1000;
+
+    if (!arg.empty() && std::isdigit(arg[0])) {
+      count = atoi(arg.c_str());
+    }
+
+    if (count <= 0) {
+      count = 1000;
+    }
+
+    std::mt19937 rng(1024);
+    std::uniform_int_distribution<int> coord_dist(0, 1023);
+    std::vector<Vector2f> path;
+
+    for (int attempts = 0; path.size() < kPathNodes && attempts < 1000; ++attempts) {
+      Vector2f from((float)coord_dist(rng) + 0.5f, (float)coord_dist(rng) + 0.5f);
+      Vector2f to((float)coord_dist(rng) + 0.5f, (float)coord_dist(rng) + 0.5f);
+
+      if (!map.CanPathOn(from, radius) || !map.CanPathOn(to, radius)) continue;
+      if (!bot.GetRegions().IsConnected(from, to)) continue;
+
+      path = bot.GetPathfinder().FindPath(map, std::vector<Vector2f>(), from, to, radius);
+    }
+
+    if (path.size() < kPathNodes) {
+      game.SendPrivateMessage(sender, "No path with enough nodes found.");
+      return;
+    }
+
+    path.resize(kPathNodes);
+
+    std::vector<float> lengths = path::PathNodeSearch::CreateArcLengths(path);
+    std::uniform_int_distribution<int> node_dist(0, (int)kPathNodes - 1);
+    std::uniform_int_distribution<int> offset_dist(-20, 20);
+    std::vector<Vector2f> positions;
+
+    for (int attempts = 0; (int)positions.size() < count && attempts < count * 100; ++attempts) {
+      Vector2f position = path[node_dist(rng)] + Vector2f((float)offset_dist(rng), (float)offset_dist(rng));
+
+      if (!map.CanPathOn(position, radius)) continue;
+
+      positions.push_back(position);
+    }
+
+    count = (int)positions.size();
+
+    PerformanceTimer timer;
+    auto search = path::PathNodeSearch::Create(bot, path, lengths, 100);
+    u64 bind_time = timer.GetElapsedTime();
+
+    std::vector<std::size_t> results;
+
+    results.reserve(positions.size());
+
+    for (const Vector2f& position : positions) {
+      results.push_back(search->FindNearestNodeBFS(position));
+    }
+
+    u64 query_time = timer.GetElapsedTime();
+    std::size_t mismatches = 0;
+
+    for (std::size_t result : results) {
+      MapCoord coord = path[result];
+      std::size_t first = 0;
+
+      while (!(MapCoord(path[first]) == coord)) {
+        ++first;
+      }
+
+      if (first != result) {
+        ++mismatches;
+      }
+    }
+
+    char message[256];
+    sprintf(message, "Path nodes: %zu  Bind: %lluus  Queries: %d  Time per query: %.2fus  Mismatches: %zu",
+            path.size(), bind_time, count, count > 0 ? (float)query_time / count : 0.0f, mismatches);
+
+    debug_log << game.GetMapFile() << " " << message << std::endl;
+    game.SendPrivateMessage(sender, message);
+  }
+
+  CommandAccessFlags GetAccess(Bot& bot) { return CommandAccess_Private; }
+  CommandFlags GetFlags() { return CommandFlag_Lockable; }
+  std::vector<std::string> GetAliases() { return {"nodebench"}; }
+  std::string GetDescription() { return "Times nearest path node searches on a 500 node path"; }
+  int GetSecurityLevel() { return 5; }
+};
+
+}  // namespace marvin
@@ -3,6 +3,7 @@
 #include "../Bot.h"
 #include "../Common.h"
 #include "BaseDuelCommands.h"
+#include "BenchmarkCommands.h"
 #include "FightingRoleCommands.h"
 #include "CommandsCommand.h"
 #include "DelimiterCommand.h"
@@ -14,6 +15,7 @@
 #include "ConsumableCommands.h"
 #include "SetFreqCommand.h"
 #include "SetShipCommand.h"
+#include "SetTileCommand.h"
 #include "SwarmCommand.h"
 
 namespace marvin {
@@ -41,6 +43,7 @@ CommandSystem::CommandSystem() {
 
   RegisterCommand(std::make_shared<SetShipCommand>());
   RegisterCommand(std::make_shared<SetFreqCommand>());
+  RegisterCommand(std::make_shared<SetTileCommand>());
 
   RegisterCommand(std::make_shared<LockFreqCommand>());
   RegisterCommand(std::make_shared<UnlockFreqCommand>());
@@ -77,6 +80,11 @@ CommandSystem::CommandSystem() {
   RegisterCommand(std::make_shared<PortalOffCommand>());
   RegisterCommand(std::make_shared<ThorCommand>());
   RegisterCommand(std::make_shared<ThorOffCommand>());
+
+  RegisterCommand(std::make_shared<PathBenchmarkCommand>());
+  RegisterCommand(std::make_shared<PathCacheCommand>());
+  RegisterCommand(std::make_shared<WeightBenchmarkCommand>());
+  RegisterCommand(std::make_shared<NodeSearchBenchmarkCommand>());
 }
 
 int CommandSystem::GetSecurityLevel(const std::string& player) {
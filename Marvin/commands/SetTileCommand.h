@@ -0,0 +1,65 @@
+#pragma once
+
+#include "../Bot.h"
+#include "CommandSystem.h"
+
+namespace marvin {
+
+// The proxy only loads the tiles from the map file and doesn't see the tiles that the zone changes at runtime, so
+// walls that are opened or closed need to be passed on with this to keep the regions and the pathfinder in sync.
+// Several tiles can be given at once so a whole wall is updated in one pass.
+class SetTileCommand : public CommandExecutor {
+ public:
+  void Execute(CommandSystem& cmd, Bot& bot, const std::string& sender, const std::string& arg) override {
+    GameProxy& game = bot.GetGame();
+
+    std::vector<std::string> args = Tokenize(arg, ' ');
+
+    if (args.empty() || args.size() % 3 != 0) {
+      SendUsage(game, sender);
+      return;
+    }
+
+    for (const std::string& token : args) {
+      if (token.empty() || !std::isdigit(token[0])) {
+        SendUsage(game, sender);
+        return;
+      }
+    }
+
+    std::vector<std::pair<MapCoord, u8>> tiles;
+
+    for (std::size_t i = 0; i < args.size(); i += 3) {
+      int x = atoi(args[i].c_str());
+      int y = atoi(args[i + 1].c_str());
+      int id = atoi(args[i + 2].c_str());
+
+      if (x < 0 || x > 1023 || y < 0 || y > 1023 || id > 255) {
+        SendUsage(game, sender);
+        return;
+      }
+
+      tiles.emplace_back(MapCoord((u16)x, (u16)y), (u8)id);
+    }
+
+    bot.SetTileIds(tiles);
+
+    if (tiles.size() == 1) {
+      game.SendPrivateMessage(sender, "Tile " + args[0] + ", " + args[1] + " set to " + args[2] + ".");
+    } else {
+      game.SendPrivateMessage(sender, std::to_string(tiles.size()) + " tiles set.");
+    }
+  }
+
+  void SendUsage(GameProxy& game, const std::string& sender) {
+    game.SendPrivateMessage(sender, "Invalid tile. !settile [x] [y] [tileId] ...");
+  }
+
+  CommandAccessFlags GetAccess(Bot& bot) { return CommandAccess_Private; }
+  CommandFlags GetFlags() { return CommandFlag_Lockable; }
+  std::vector<std::string> GetAliases() { return {"settile"}; }
+  std::string GetDescription() { return "Sets map tiles and updates the regions and paths around them"; }
+  int GetSecurityLevel() { return 5; }
+};
+
+}  // namespace marvin
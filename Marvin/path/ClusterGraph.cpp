@@ -0,0 +1,470 @@
+#include "ClusterGraph.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+
+#include "../MapCache.h"
+
+namespace marvin {
+namespace path {
+
+constexpr float kInfiniteCost = std::numeric_limits<float>::max();
+constexpr u32 kInvalidEntrance = 0xFFFFFFFF;
+
+// Long open runs along a border get an entrance at each end instead of a single one in the middle.
+constexpr u16 kMaxSingleEntranceLength = 6;
+
+void ClusterGraph::Build() {
+  CreateEntrances();
+
+  for (std::size_t cluster = 0; cluster < kClusterCount; ++cluster) {
+    ConnectCluster(cluster);
+  }
+}
+
+void ClusterGraph::Build(const ClusterTiles& tiles) {
+  tiles_ = &tiles;
+  Build();
+  tiles_ = nullptr;
+
+  // The loaded cluster holds costs from the copies.
+  loaded_cluster_ = kClusterCount;
+}
+
+void ClusterGraph::Update(int min_x, int min_y, int max_x, int max_y) {
+  int min_cluster_x = std::max(min_x, 0) / kClusterSize;
+  int min_cluster_y = std::max(min_y, 0) / kClusterSize;
+  int max_cluster_x = std::min(max_x, 1023) / kClusterSize;
+  int max_cluster_y = std::min(max_y, 1023) / kClusterSize;
+
+  std::vector<Entrance> old_entrances = std::move(entrances_);
+  std::vector<u32> old_cluster_entrances[kClusterCount];
+
+  for (std::size_t i = 0; i < kClusterCount; ++i) {
+    old_cluster_entrances[i] = std::move(cluster_entrances_[i]);
+  }
+
+  // Placing the entrances is cheap compared to the searches, so every border is placed again.
+  CreateEntrances();
+
+  for (std::size_t cluster = 0; cluster < kClusterCount; ++cluster) {
+    const std::vector<u32>& cluster_entrances = cluster_entrances_[cluster];
+    const std::vector<u32>& old_indices = old_cluster_entrances[cluster];
+
+    int cluster_x = (int)(cluster % kClustersPerRow);
+    int cluster_y = (int)(cluster / kClustersPerRow);
+    bool changed = cluster_x >= min_cluster_x && cluster_x <= max_cluster_x && cluster_y >= min_cluster_y &&
+                   cluster_y <= max_cluster_y;
+
+    // The clusters outside of the area keep their paths unless the entrances on their borders moved. Entrances are
+    // placed in the same order every time, so an unchanged cluster has the same list.
+    changed = changed || cluster_entrances.size() != old_indices.size();
+
+    for (std::size_t i = 0; i < old_indices.size() && !changed; ++i) {
+      changed = !(entrances_[cluster_entrances[i]].point == old_entrances[old_indices[i]].point);
+    }
+
+    if (changed) {
+      ConnectCluster(cluster);
+      continue;
+    }
+
+    auto find_entrance = [&](u32 old_index) {
+      for (std::size_t i = 0; i < old_indices.size(); ++i) {
+        if (old_indices[i] == old_index) return cluster_entrances[i];
+      }
+      return kInvalidEntrance;
+    };
+
+    for (std::size_t i = 0; i < old_indices.size(); ++i) {
+      for (const Edge& edge : old_entrances[old_indices[i]].edges) {
+        // The edges that leave the cluster were placed along with the entrances.
+        if (GetCluster(old_entrances[edge.to].point) != cluster) continue;
+
+        ConnectEntrances(cluster_entrances[i], find_entrance(edge.to), edge.cost);
+      }
+    }
+  }
+}
+
+void ClusterGraph::CreateEntrances() {
+  entrances_.clear();
+  loaded_cluster_ = kClusterCount;
+
+  for (std::size_t i = 0; i < kClusterCount; ++i) {
+    cluster_entrances_[i].clear();
+  }
+
+  for (u16 cluster_y = 0; cluster_y < kClustersPerRow; ++cluster_y) {
+    for (u16 cluster_x = 0; cluster_x < kClustersPerRow; ++cluster_x) {
+      u16 left = cluster_x * kClusterSize;
+      u16 top = cluster_y * kClusterSize;
+
+      // Create the entrances along the east border and the south border.
+      if (cluster_x + 1 < kClustersPerRow) {
+        CreateBorderEntrances(NodePoint(left + kClusterSize - 1, top), NodePoint(0, 1), NodePoint(1, 0));
+      }
+
+      if (cluster_y + 1 < kClustersPerRow) {
+        CreateBorderEntrances(NodePoint(left, top + kClusterSize - 1), NodePoint(1, 0), NodePoint(0, 1));
+      }
+    }
+  }
+}
+
+void ClusterGraph::ConnectCluster(std::size_t cluster) {
+  const std::vector<u32>& cluster_entrances = cluster_entrances_[cluster];
+
+  for (u32 from : cluster_entrances) {
+    SearchCluster(entrances_[from].point, false);
+
+    for (u32 to : cluster_entrances) {
+      if (from == to) continue;
+
+      float cost = GetSearchCost(entrances_[to].point);
+
+      if (cost < kInfiniteCost) {
+        ConnectEntrances(from, to, cost);
+      }
+    }
+  }
+}
+
+std::vector<NodePoint> ClusterGraph::FindPath(NodePoint start, NodePoint goal) {
+  std::vector<NodePoint> path;
+
+  nodes_expanded_ = 0;
+
+  // The start and goal are inserted into the graph as two temporary nodes after the entrances.
+  const u32 start_index = (u32)entrances_.size();
+  const u32 goal_index = start_index + 1;
+  const std::size_t start_cluster = GetCluster(start);
+  const std::size_t goal_cluster = GetCluster(goal);
+
+  std::vector<Edge> start_edges;
+  std::vector<Edge> goal_edges;
+
+  SearchCluster(start, false);
+
+  for (u32 entrance : cluster_entrances_[start_cluster]) {
+    float cost = GetSearchCost(entrances_[entrance].point);
+
+    if (cost < kInfiniteCost) {
+      start_edges.emplace_back(entrance, cost);
+    }
+  }
+
+  if (start_cluster == goal_cluster && GetSearchCost(goal) < kInfiniteCost) {
+    start_edges.emplace_back(goal_index, GetSearchCost(goal));
+  }
+
+  SearchCluster(goal, true);
+
+  for (u32 entrance : cluster_entrances_[goal_cluster]) {
+    float cost = GetSearchCost(entrances_[entrance].point);
+
+    if (cost < kInfiniteCost) {
+      goal_edges.emplace_back(entrance, cost);
+    }
+  }
+
+  auto get_point = [&](u32 index) {
+    if (index == start_index) return start;
+    if (index == goal_index) return goal;
+    return entrances_[index].point;
+  };
+
+  auto heuristic = [&](u32 index) {
+    NodePoint point = get_point(index);
+    float dx = (float)point.x - goal.x;
+    float dy = (float)point.y - goal.y;
+
+    return std::sqrt(dx * dx + dy * dy);
+  };
+
+  using OpenEntry = std::pair<float, u32>;
+
+  std::vector<float> g(goal_index + 1, kInfiniteCost);
+  std::vector<u32> parents(goal_index + 1, kInvalidEntrance);
+  std::vector<bool> closed(goal_index + 1, false);
+  std::priority_queue<OpenEntry, std::vector<OpenEntry>, std::greater<OpenEntry>> openset;
+
+  g[start_index] = 0.0f;
+  openset.emplace(heuristic(start_index), start_index);
+
+  while (!openset.empty()) {
+    u32 current = openset.top().second;
+    openset.pop();
+
+    if (closed[current]) continue;
+    if (current == goal_index) break;
+
+    closed[current] = true;
+    ++nodes_expanded_;
+
+    auto relax = [&](u32 to, float cost) {
+      float new_g = g[current] + cost;
+
+      if (new_g < g[to]) {
+        g[to] = new_g;
+        parents[to] = current;
+        openset.emplace(new_g + heuristic(to), to);
+      }
+    };
+
+    if (current == start_index) {
+      for (const Edge& edge : start_edges) {
+        relax(edge.to, edge.cost);
+      }
+      continue;
+    }
+
+    for (const Edge& edge : entrances_[current].edges) {
+      relax(edge.to, edge.cost);
+    }
+
+    if (GetCluster(entrances_[current].point) == goal_cluster) {
+      for (const Edge& edge : goal_edges) {
+        if (edge.to == current) {
+          relax(goal_index, edge.cost);
+        }
+      }
+    }
+  }
+
+  if (parents[goal_index] == kInvalidEntrance) {
+    return path;
+  }
+
+  for (u32 current = goal_index; current != kInvalidEntrance; current = parents[current]) {
+    path.push_back(get_point(current));
+  }
+
+  std::reverse(path.begin(), path.end());
+
+  return path;
+}
+
+u32 ClusterGraph::AddEntrance(NodePoint point) {
+  std::vector<u32>& cluster_entrances = cluster_entrances_[GetCluster(point)];
+
+  // Cluster corners sit on two borders, so the same tile can be selected twice.
+  for (u32 index : cluster_entrances) {
+    if (entrances_[index].point == point) {
+      return index;
+    }
+  }
+
+  u32 index = (u32)entrances_.size();
+
+  entrances_.emplace_back(point);
+  cluster_entrances.push_back(index);
+
+  return index;
+}
+
+void ClusterGraph::CreateBorderEntrances(NodePoint start, NodePoint step, NodePoint across) {
+  u16 run_start = 0;
+  u16 run_length = 0;
+
+  for (u16 i = 0; i <= kClusterSize; ++i) {
+    bool open = false;
+
+    if (i < kClusterSize) {
+      u16 x = start.x + step.x * i;
+      u16 y = start.y + step.y * i;
+
+      open = IsPathable(x, y) && IsPathable(x + across.x, y + across.y);
+    }
+
+    if (open) {
+      if (run_length == 0) {
+        run_start = i;
+      }
+
+      ++run_length;
+      continue;
+    }
+
+    if (run_length == 0) continue;
+
+    u16 offsets[2] = {(u16)(run_start + run_length / 2), 0};
+    std::size_t offset_count = 1;
+
+    if (run_length >= kMaxSingleEntranceLength) {
+      offsets[0] = run_start;
+      offsets[1] = run_start + run_length - 1;
+      offset_count = 2;
+    }
+
+    for (std::size_t j = 0; j < offset_count; ++j) {
+      NodePoint inside(start.x + step.x * offsets[j], start.y + step.y * offsets[j]);
+      NodePoint outside(inside.x + across.x, inside.y + across.y);
+
+      u32 inside_index = AddEntrance(inside);
+      u32 outside_index = AddEntrance(outside);
+
+      ConnectEntrances(inside_index, outside_index, GetTileCost(outside.x, outside.y));
+      ConnectEntrances(outside_index, inside_index, GetTileCost(inside.x, inside.y));
+    }
+
+    run_length = 0;
+  }
+}
+
+void ClusterGraph::ConnectEntrances(u32 first, u32 second, float cost) {
+  entrances_[first].edges.emplace_back(second, cost);
+}
+
+void ClusterGraph::LoadCluster(std::size_t cluster) {
+  if (cluster == loaded_cluster_) return;
+
+  const u16 left = (u16)(cluster % kClustersPerRow) * kClusterSize;
+  const u16 top = (u16)(cluster / kClustersPerRow) * kClusterSize;
+
+  for (u16 y = 0; y < kClusterSize; ++y) {
+    for (u16 x = 0; x < kClusterSize; ++x) {
+      std::size_t index = y * kClusterSize + x;
+
+      tile_costs_[index] = IsPathable(left + x, top + y) ? GetTileCost(left + x, top + y) : kInfiniteCost;
+    }
+  }
+
+  loaded_cluster_ = cluster;
+}
+
+void ClusterGraph::SearchCluster(NodePoint point, bool reverse) {
+  using OpenEntry = std::pair<float, u16>;
+
+  LoadCluster(GetCluster(point));
+
+  for (std::size_t i = 0; i < kClusterSize * kClusterSize; ++i) {
+    search_costs_[i] = kInfiniteCost;
+  }
+
+  std::priority_queue<OpenEntry, std::vector<OpenEntry>, std::greater<OpenEntry>> openset;
+
+  u16 start_index = (point.y % kClusterSize) * kClusterSize + (point.x % kClusterSize);
+
+  search_costs_[start_index] = 0.0f;
+  openset.emplace(0.0f, start_index);
+
+  while (!openset.empty()) {
+    OpenEntry entry = openset.top();
+    openset.pop();
+
+    if (entry.first > search_costs_[entry.second]) continue;
+
+    int x = entry.second % kClusterSize;
+    int y = entry.second / kClusterSize;
+
+    for (int dy = -1; dy <= 1; ++dy) {
+      for (int dx = -1; dx <= 1; ++dx) {
+        if (dx == 0 && dy == 0) continue;
+
+        int next_x = x + dx;
+        int next_y = y + dy;
+
+        if (next_x < 0 || next_x >= kClusterSize) continue;
+        if (next_y < 0 || next_y >= kClusterSize) continue;
+
+        u16 next_index = next_y * kClusterSize + next_x;
+
+        if (tile_costs_[next_index] == kInfiniteCost) continue;
+
+        float distance = 1.0f;
+
+        // Diagonal movement is only allowed when both sides can be pathed on, the same as FindEdges.
+        if (dx != 0 && dy != 0) {
+          if (tile_costs_[y * kClusterSize + next_x] == kInfiniteCost) continue;
+          if (tile_costs_[next_y * kClusterSize + x] == kInfiniteCost) continue;
+
+          distance = 1.41421356f;
+        }
+
+        // Moving out of the current tile costs its weight when searching backwards from the point.
+        float weight = reverse ? tile_costs_[entry.second] : tile_costs_[next_index];
+        float cost = entry.first + weight * distance;
+
+        if (cost < search_costs_[next_index]) {
+          search_costs_[next_index] = cost;
+          openset.emplace(cost, next_index);
+        }
+      }
+    }
+  }
+}
+
+float ClusterGraph::GetSearchCost(NodePoint point) const {
+  return search_costs_[(point.y % kClusterSize) * kClusterSize + (point.x % kClusterSize)];
+}
+
+bool ClusterGraph::IsPathable(u16 x, u16 y) {
+  if (x >= 1024 || y >= 1024) return false;
+
+  if (tiles_) {
+    return !tiles_->map.IsSolid(x, y) && (tiles_->tile_flags[y * 1024 + x] & TileFlag_Pathable);
+  }
+
+  if (map_.IsSolid(x, y)) return false;
+
+  return processor_.IsPathable(NodePoint(x, y));
+}
+
+float ClusterGraph::GetTileCost(u16 x, u16 y) {
+  if (tiles_) {
+    return tiles_->weight_palette[tiles_->weight_indices[y * 1024 + x]];
+  }
+
+  return processor_.GetWeight(NodePoint(x, y));
+}
+
+void ClusterGraph::Save(CacheWriter& writer) const {
+  writer.Write((u32)entrances_.size());
+
+  for (const Entrance& entrance : entrances_) {
+    writer.Write(entrance.point);
+    writer.Write((u32)entrance.edges.size());
+    writer.WriteArray(entrance.edges.data(), entrance.edges.size());
+  }
+
+  for (std::size_t i = 0; i < kClusterCount; ++i) {
+    writer.WriteVector(cluster_entrances_[i]);
+  }
+}
+
+bool ClusterGraph::Load(CacheReader& reader) {
+  u32 entrance_count = 0;
+
+  entrances_.clear();
+  loaded_cluster_ = kClusterCount;
+
+  if (!reader.Read(entrance_count)) return false;
+
+  for (u32 i = 0; i < entrance_count; ++i) {
+    NodePoint point;
+    u32 edge_count = 0;
+
+    if (!reader.Read(point) || !reader.Read(edge_count)) return false;
+
+    entrances_.emplace_back(point);
+
+    Entrance& entrance = entrances_.back();
+
+    entrance.edges.assign(edge_count, Edge(0, 0.0f));
+
+    if (!reader.ReadArray(entrance.edges.data(), edge_count)) return false;
+  }
+
+  for (std::size_t i = 0; i < kClusterCount; ++i) {
+    if (!reader.ReadVector(cluster_entrances_[i])) return false;
+  }
+
+  return true;
+}
+
+}  // namespace path
+}  // namespace marvin
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+
+#include "../Map.h"
+#include "NodeProcessor.h"
+
+namespace marvin {
+namespace path {
+
+constexpr u16 kClusterSize = 32;
+constexpr u16 kClustersPerRow = 1024 / kClusterSize;
+constexpr std::size_t kClusterCount = kClustersPerRow * kClustersPerRow;
+
+// Copies of the tile data that a cluster graph is built from, so a worker can build a graph while the map and the
+// processor keep changing.
+struct ClusterTiles {
+  Map map;
+  std::vector<TileFlags> tile_flags;
+  std::vector<u8> weight_indices;
+  std::vector<float> weight_palette;
+
+  ClusterTiles(const Map& map, const NodeProcessor& processor)
+      : map(map),
+        tile_flags(processor.GetTileFlags()),
+        weight_indices(processor.GetWeightIndices()),
+        weight_palette(processor.GetWeightPalette()) {}
+};
+
+// Abstract graph for hierarchical pathfinding.
+// The map is split into fixed size clusters and an entrance is placed on both sides of each open run along the
+// cluster borders. Entrances in the same cluster are connected with the cost of the best path between them inside
+// the cluster, so long searches only need to visit the entrances instead of every tile.
+class ClusterGraph {
+ public:
+  struct Edge {
+    u32 to;
+    float cost;
+
+    Edge(u32 to, float cost) : to(to), cost(cost) {}
+  };
+
+  struct Entrance {
+    NodePoint point;
+    std::vector<Edge> edges;
+
+    Entrance(NodePoint point) : point(point) {}
+  };
+
+  ClusterGraph(NodeProcessor& processor, const Map& map) : processor_(processor), map_(map) {}
+
+  // Builds the entrances and the costs between them from the pathable flags and weights in the processor.
+  // This needs to be rebuilt whenever either of those change.
+  void Build();
+  // Builds the graph from copies of the tiles instead of the processor. Later updates read the processor again.
+  void Build(const ClusterTiles& tiles);
+  // Rebuilds the graph after the pathable flags or weights changed inside of the area. Only the clusters that the
+  // area touches and the ones whose entrances moved are searched again, and the result is the same as calling Build.
+  void Update(int min_x, int min_y, int max_x, int max_y);
+
+  // Searches the abstract graph and returns the entrances that the path goes through, including the start and goal.
+  // Returns an empty path if the goal can't be reached.
+  std::vector<NodePoint> FindPath(NodePoint start, NodePoint goal);
+
+  void Save(CacheWriter& writer) const;
+  bool Load(CacheReader& reader);
+
+  std::size_t GetEntranceCount() const { return entrances_.size(); }
+  // The number of abstract nodes expanded during the last search.
+  std::size_t GetNodesExpanded() const { return nodes_expanded_; }
+
+  static inline std::size_t GetCluster(NodePoint point) {
+    return (point.y / kClusterSize) * kClustersPerRow + (point.x / kClusterSize);
+  }
+
+ private:
+  // Places the entrances along every cluster border along with the edges that cross the borders.
+  void CreateEntrances();
+  // Connects the entrances inside of the cluster with the cost of the best path between them.
+  void ConnectCluster(std::size_t cluster);
+
+  u32 AddEntrance(NodePoint point);
+  void CreateBorderEntrances(NodePoint start, NodePoint step, NodePoint across);
+  void ConnectEntrances(u32 first, u32 second, float cost);
+
+  // Caches the tile costs of the cluster so repeated searches inside of it don't need to go through the processor.
+  void LoadCluster(std::size_t cluster);
+  // Runs Dijkstra from the point while staying inside of its cluster. The costs are stored in search_costs_ using
+  // the local cluster index. When reverse is set, the costs are for moving from each tile to the point instead.
+  void SearchCluster(NodePoint point, bool reverse);
+  float GetSearchCost(NodePoint point) const;
+
+  bool IsPathable(u16 x, u16 y);
+  float GetTileCost(u16 x, u16 y);
+
+  NodeProcessor& processor_;
+  const Map& map_;
+  // The copies that the graph reads while it's built from them.
+  const ClusterTiles* tiles_ = nullptr;
+
+  std::vector<Entrance> entrances_;
+  // The entrances that exist in each cluster.
+  std::vector<u32> cluster_entrances_[kClusterCount];
+
+  // Cost of moving onto each tile in the loaded cluster. Tiles that can't be pathed on have an infinite cost.
+  float tile_costs_[kClusterSize * kClusterSize];
+  std::size_t loaded_cluster_ = kClusterCount;
+  float search_costs_[kClusterSize * kClusterSize];
+  std::size_t nodes_expanded_ = 0;
+};
+
+}  // namespace path
+}  // namespace marvin
@@ -0,0 +1,120 @@
+#include "DistanceField.h"
+
+#include <algorithm>
+
+#include "../TaskGraph.h"
+
+namespace marvin {
+namespace path {
+
+constexpr float kNoWall = 1.0e20f;
+
+// The map is padded with a solid border so walls outside of the map are found like any other wall.
+constexpr int kFieldExtent = (int)kMapExtent + 2;
+
+// Position where the parabola rooted at q crosses the parabola rooted at v.
+inline float GetIntersection(const float* input, int q, int v) {
+  return ((input[q] + q * q) - (input[v] + v * v)) / (2.0f * q - 2.0f * v);
+}
+
+// Squared distance transform of a single line. Each input is the squared distance to the nearest wall in the
+// other dimension, and the result is the lower envelope of the parabolas rooted at each of them.
+static void TransformLine(const float* input, float* output, int count, int* vertices, float* boundaries) {
+  int k = 0;
+
+  vertices[0] = 0;
+  boundaries[0] = -kNoWall;
+  boundaries[1] = kNoWall;
+
+  for (int q = 1; q < count; ++q) {
+    float intersection = GetIntersection(input, q, vertices[k]);
+
+    // Remove the parabolas that the new one is lower than for their entire range.
+    while (intersection <= boundaries[k]) {
+      --k;
+      intersection = GetIntersection(input, q, vertices[k]);
+    }
+
+    ++k;
+    vertices[k] = q;
+    boundaries[k] = intersection;
+    boundaries[k + 1] = kNoWall;
+  }
+
+  k = 0;
+
+  for (int q = 0; q < count; ++q) {
+    while (boundaries[k + 1] < q) {
+      ++k;
+    }
+
+    int v = vertices[k];
+    output[q] = (float)((q - v) * (q - v)) + input[v];
+  }
+}
+
+// Runs the function over the range of lines. The lines are split into one job for each worker when there's a pool.
+template <typename F>
+static void ForEachLine(int count, WorkerPool* workers, F function) {
+  if (workers == nullptr) {
+    for (int line = 0; line < count; ++line) {
+      function(line);
+    }
+    return;
+  }
+
+  int job_count = std::max(1, (int)workers->GetThreadCount());
+  int lines_per_job = (count + job_count - 1) / job_count;
+  TaskGraph graph;
+
+  for (int begin = 0; begin < count; begin += lines_per_job) {
+    int end = std::min(begin + lines_per_job, count);
+
+    graph.Add("lines", [begin, end, &function]() {
+      for (int line = begin; line < end; ++line) {
+        function(line);
+      }
+    });
+  }
+
+  graph.Run(*workers);
+}
+
+std::vector<float> CreateWallDistanceField(const Map& map, WorkerPool* workers) {
+  std::vector<float> columns(kFieldExtent * kFieldExtent);
+
+  // Vertical distances are stored transposed so both passes read and write contiguous lines.
+  ForEachLine(kFieldExtent, workers, [&map, &columns](int x) {
+    float input[kFieldExtent];
+    int vertices[kFieldExtent];
+    float boundaries[kFieldExtent + 1];
+
+    for (int y = 0; y < kFieldExtent; ++y) {
+      input[y] = map.IsSolid((u16)(x - 1), (u16)(y - 1)) ? 0.0f : kNoWall;
+    }
+
+    TransformLine(input, &columns[x * kFieldExtent], kFieldExtent, vertices, boundaries);
+  });
+
+  std::vector<float> distances(kMapExtent * kMapExtent);
+
+  ForEachLine((int)kMapExtent, workers, [&columns, &distances](int y) {
+    float input[kFieldExtent];
+    float output[kFieldExtent];
+    int vertices[kFieldExtent];
+    float boundaries[kFieldExtent + 1];
+
+    for (int x = 0; x < kFieldExtent; ++x) {
+      input[x] = columns[x * kFieldExtent + y + 1];
+    }
+
+    TransformLine(input, output, kFieldExtent, vertices, boundaries);
+
+    std::copy(output + 1, output + 1 + kMapExtent, &distances[y * kMapExtent]);
+  });
+
+  return distances;
+}
+
+}  // namespace path
+}  // namespace marvin
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <vector>
+
+#include "../Map.h"
+
+namespace marvin {
+
+class WorkerPool;
+
+namespace path {
+
+// Calculates the exact squared euclidean distance from every tile to the nearest solid tile. Tiles outside of the
+// map count as solid.
+// This is the separable lower envelope transform from Felzenszwalb and Huttenlocher. It runs one pass down the
+// columns and one pass across the rows, so the cost is linear in the number of tiles no matter how far away the
+// walls are. Each pass is split into jobs on the worker pool when one is passed, and runs on the calling thread
+// otherwise. The pool must not be the one that the caller is running a job on.
+std::vector<float> CreateWallDistanceField(const Map& map, WorkerPool* workers = nullptr);
+
+}  // namespace path
+}  // namespace marvin
@@ -0,0 +1,201 @@
+#include "FlowField.h"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+
+#include "../WorkerPool.h"
+
+namespace marvin {
+namespace path {
+
+void FlowField::Build(const FlowFieldTiles& tiles) {
+  using OpenEntry = std::pair<float, u32>;
+
+  distances_.assign(kMaxNodes, kUnreachable);
+  steps_.assign(kMaxNodes, kNoStep);
+
+  if (goal_.x >= 1024 || goal_.y >= 1024) return;
+
+  // Only a few tiles are stamped, so they're spread into a full map here instead of being copied as one.
+  std::vector<float> hazard_costs(kMaxNodes, 0.0f);
+
+  for (const FlowFieldTiles::Hazard& hazard : tiles.hazards) {
+    hazard_costs[hazard.index] = hazard.cost;
+  }
+
+  std::priority_queue<OpenEntry, std::vector<OpenEntry>, std::greater<OpenEntry>> openset;
+  u32 goal_index = goal_.y * 1024 + goal_.x;
+
+  distances_[goal_index] = 0.0f;
+  openset.emplace(0.0f, goal_index);
+
+  while (!openset.empty()) {
+    OpenEntry entry = openset.top();
+    openset.pop();
+
+    u32 index = entry.second;
+
+    // The tile was already settled with a shorter distance.
+    if (entry.first > distances_[index]) continue;
+
+    NodePoint point((u16)(index % 1024), (u16)(index / 1024));
+    float weight = tiles.weight_palette[tiles.weight_indices[index]];
+
+    if (hazard_costs[index] != 0.0f) {
+      weight = hazard_costs[index];
+    }
+
+    float enter_cost = std::max(weight, 1.0f);
+
+    // Walk the edges backwards by finding the neighbors that can step onto this tile.
+    for (u8 i = 0; i < 8; ++i) {
+      NodePoint from(point.x - kNeighborOffsets[i][0], point.y - kNeighborOffsets[i][1]);
+
+      if (from.x >= 1024 || from.y >= 1024) continue;
+      u32 from_index = from.y * 1024 + from.x;
+
+      if (!(tiles.neighbor_masks[from_index] & (1 << i))) continue;
+
+      float distance = entry.first + enter_cost * (i >= 4 ? 1.41421356f : 1.0f);
+
+      if (distance < distances_[from_index]) {
+        distances_[from_index] = distance;
+        steps_[from_index] = i;
+        openset.emplace(distance, from_index);
+      }
+    }
+  }
+}
+
+NodePoint FlowField::GetNextStep(NodePoint point) const {
+  if (point.x >= 1024 || point.y >= 1024) return point;
+
+  u8 step = steps_[point.y * 1024 + point.x];
+
+  if (step == kNoStep) return point;
+
+  return NodePoint(point.x + kNeighborOffsets[step][0], point.y + kNeighborOffsets[step][1]);
+}
+
+std::vector<Vector2f> FlowField::GetPath(NodePoint from) const {
+  std::vector<Vector2f> path;
+
+  if (!IsReachable(from)) return path;
+
+  NodePoint point = from;
+
+  path.emplace_back(point.x + 0.5f, point.y + 0.5f);
+
+  while (!(point == goal_)) {
+    point = GetNextStep(point);
+    path.emplace_back(point.x + 0.5f, point.y + 0.5f);
+  }
+
+  return path;
+}
+
+const FlowField* FlowFieldCache::Get(const NodeProcessor& processor, NodePoint goal, u32 map_version,
+                                     u32 hazard_hash, WorkerPool* workers) {
+  CollectBuilds(map_version);
+
+  auto iter = std::find_if(fields_.begin(), fields_.end(), [goal](const FlowField& field) {
+    return field.GetGoal() == goal;
+  });
+
+  if (iter != fields_.end()) {
+    fields_.splice(fields_.begin(), fields_, iter);
+
+    if (iter->GetMapVersion() == map_version && iter->GetHazardHash() == hazard_hash) {
+      return &*iter;
+    }
+
+    // The field would lead through hazards that were stamped since it was built.
+    fields_.pop_front();
+  }
+
+  if (workers == nullptr) {
+    fields_.emplace_front(goal, map_version, hazard_hash);
+    fields_.front().Build(FlowFieldTiles(processor));
+    ++build_count_;
+
+    while (fields_.size() > capacity_) {
+      fields_.pop_back();
+    }
+
+    return &fields_.front();
+  }
+
+  PendingBuild build{goal, hazard_hash};
+
+  if (std::find(building_.begin(), building_.end(), build) != building_.end()) {
+    return nullptr;
+  }
+
+  building_.push_back(build);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++running_;
+  }
+
+  auto tiles = std::make_shared<FlowFieldTiles>(processor);
+
+  workers->Submit([this, tiles, goal, map_version, hazard_hash]() {
+    auto field = std::make_unique<FlowField>(goal, map_version, hazard_hash);
+
+    field->Build(*tiles);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    finished_.push_back(std::move(field));
+    --running_;
+    done_.notify_all();
+  });
+
+  return nullptr;
+}
+
+FlowFieldCache::~FlowFieldCache() {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  done_.wait(lock, [this]() { return running_ == 0; });
+}
+
+void FlowFieldCache::Clear() {
+  building_.clear();
+  fields_.clear();
+}
+
+void FlowFieldCache::CollectBuilds(u32 map_version) {
+  std::vector<std::unique_ptr<FlowField>> finished;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished.swap(finished_);
+  }
+
+  for (std::unique_ptr<FlowField>& field : finished) {
+    NodePoint goal = field->GetGoal();
+
+    // The map changed while the field was being built.
+    if (field->GetMapVersion() != map_version) continue;
+
+    auto building = std::find(building_.begin(), building_.end(), PendingBuild{goal, field->GetHazardHash()});
+
+    if (building != building_.end()) {
+      building_.erase(building);
+    }
+
+    fields_.remove_if([goal](const FlowField& cached) { return cached.GetGoal() == goal; });
+    fields_.push_front(std::move(*field));
+    ++build_count_;
+  }
+
+  while (fields_.size() > capacity_) {
+    fields_.pop_back();
+  }
+}
+
+}  // namespace path
+}  // namespace marvin
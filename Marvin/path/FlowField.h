@@ -0,0 +1,134 @@
+#pragma once
+
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../Vector2f.h"
+#include "NodeProcessor.h"
+
+namespace marvin {
+
+class WorkerPool;
+
+namespace path {
+
+// A copy of the tile data that flow fields are built from, so a field can be built on another thread while the
+// processor keeps changing. The weights are copied as the small palette indices to keep the copy cheap, and only the
+// tiles that are stamped in the hazard overlay are copied with their costs.
+struct FlowFieldTiles {
+  struct Hazard {
+    u32 index;
+    float cost;
+  };
+
+  std::vector<u8> weight_indices;
+  std::vector<float> weight_palette;
+  std::vector<u8> neighbor_masks;
+  std::vector<Hazard> hazards;
+
+  FlowFieldTiles(const NodeProcessor& processor)
+      : weight_indices(processor.GetWeightIndices()),
+        weight_palette(processor.GetWeightPalette()),
+        neighbor_masks(processor.GetNeighborMasks()) {
+    for (NodePoint point : processor.GetHazards()) {
+      hazards.push_back(Hazard{(u32)(point.y * 1024 + point.x), processor.GetCost(point)});
+    }
+  }
+};
+
+// Distance from every tile to a single goal tile along the same edges that FindEdges uses.
+// The field is built once with Dijkstra from the goal, then every position can read its next step and its remaining
+// distance without searching. This is used for destinations that many bots or nodes path toward.
+// Like the incremental planner, the cost of entering a tile is never less than 1 so open areas still have a distance.
+class FlowField {
+ public:
+  FlowField(NodePoint goal, u32 map_version, u32 hazard_hash)
+      : goal_(goal), map_version_(map_version), hazard_hash_(hazard_hash) {}
+
+  // Builds the field from the tile weights with the hazard costs in place of the weights of the stamped tiles.
+  void Build(const FlowFieldTiles& tiles);
+
+  NodePoint GetGoal() const { return goal_; }
+  u32 GetMapVersion() const { return map_version_; }
+  // The hash of the hazards that were stamped when the field was built.
+  u32 GetHazardHash() const { return hazard_hash_; }
+
+  bool IsReachable(NodePoint point) const { return GetDistance(point) < kUnreachable; }
+  // Returns kUnreachable if the goal can't be reached from the point.
+  float GetDistance(NodePoint point) const {
+    if (point.x >= 1024 || point.y >= 1024) return kUnreachable;
+    return distances_[point.y * 1024 + point.x];
+  }
+
+  // Returns the neighbor to move to from the point. The goal and unreachable points return themselves.
+  NodePoint GetNextStep(NodePoint point) const;
+  // Follows the steps from the point to the goal. Returns an empty path if the goal can't be reached.
+  std::vector<Vector2f> GetPath(NodePoint from) const;
+
+  static constexpr float kUnreachable = 1.0e30f;
+
+ private:
+  static constexpr u8 kNoStep = 0xFF;
+
+  NodePoint goal_;
+  u32 map_version_;
+  u32 hazard_hash_;
+
+  std::vector<float> distances_;
+  // Index into kNeighborOffsets of the next step from each tile.
+  std::vector<u8> steps_;
+};
+
+// Keeps the most recently used flow fields. A field is rebuilt when it's requested with a different map version or
+// hazard hash than it was built with. Building a field takes a full Dijkstra over the map, so the fields are built on
+// the worker pool and the searches to the goal go back to the tiles until it's ready.
+class FlowFieldCache {
+ public:
+  // Each field is 5 MB, so only a few destinations are kept.
+  static constexpr std::size_t kDefaultCapacity = 4;
+
+  FlowFieldCache(std::size_t capacity = kDefaultCapacity) : capacity_(capacity) {}
+  // Waits for the fields that are being built since the workers write into the cache.
+  ~FlowFieldCache();
+
+  // Returns the field toward the goal if it's built for the map version and hazards. Otherwise this starts building
+  // it on the workers and returns nullptr. Without workers the field is built before returning.
+  // The hazards need to be stamped in the processor, and the hash needs to change whenever they do.
+  const FlowField* Get(const NodeProcessor& processor, NodePoint goal, u32 map_version, u32 hazard_hash,
+                       WorkerPool* workers);
+
+  // Drops every field. Fields that are still being built are dropped when they finish.
+  void Clear();
+
+  std::size_t GetBuildCount() const { return build_count_; }
+
+ private:
+  // Moves the fields that the workers finished into the cache.
+  void CollectBuilds(u32 map_version);
+
+  std::size_t capacity_;
+  // The most recently used field is at the front.
+  std::list<FlowField> fields_;
+  std::size_t build_count_ = 0;
+
+  struct PendingBuild {
+    NodePoint goal;
+    u32 hazard_hash;
+
+    bool operator==(const PendingBuild& other) const { return goal == other.goal && hazard_hash == other.hazard_hash; }
+  };
+
+  // The fields that are being built for the current map version. Only used by the thread that owns the cache.
+  std::vector<PendingBuild> building_;
+  // Fields that the workers finished and the number of builds still running, guarded by the mutex.
+  std::vector<std::unique_ptr<FlowField>> finished_;
+  std::size_t running_ = 0;
+  std::mutex mutex_;
+  std::condition_variable done_;
+};
+
+}  // namespace path
+}  // namespace marvin
@@ -0,0 +1,382 @@
+#include "IncrementalPlanner.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+
+namespace marvin {
+namespace path {
+
+constexpr float kInfinity = std::numeric_limits<float>::infinity();
+constexpr u32 kNoParent = 0xFFFFFFFF;
+
+// The bot is allowed to be one tile away from the old path and still reuse it.
+constexpr int kPathReuseDistance = 1;
+
+inline NodePoint GetPointFromIndex(u32 index) { return NodePoint((u16)(index % 1024), (u16)(index / 1024)); }
+inline u32 GetIndex(NodePoint point) { return point.y * 1024 + point.x; }
+
+bool IncrementalPlanner::Plan(NodePoint start, NodePoint goal, std::vector<NodePoint>& path) {
+  nodes_expanded_ = 0;
+  path.clear();
+
+  // The neighbor masks are only symmetric between pathable tiles, so the tree can't use the others.
+  if (!processor_.IsPathable(start) || !processor_.IsPathable(goal)) return false;
+
+  if (nodes_.empty()) {
+    nodes_.resize(kMaxNodes, PlanNode{kInfinity, kInfinity, Node::kInvalidHeapIndex, kNoParent});
+  }
+
+  if (!initialized_) {
+    Initialize(start);
+  }
+
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    SetGoal(goal);
+    UpdateHazards();
+    ComputeShortestPath();
+
+    if (nodes_[GetIndex(goal)].g == kInfinity) return true;
+
+    std::vector<NodePoint> tree_path;
+
+    for (u32 index = GetIndex(goal); index != kNoParent; index = nodes_[index].parent) {
+      tree_path.push_back(GetPointFromIndex(index));
+
+      if (tree_path.size() > kMaxNodes) return false;
+    }
+
+    std::reverse(tree_path.begin(), tree_path.end());
+
+    // Find the furthest tile of the path that the bot is standing on or next to.
+    std::size_t reuse_index = tree_path.size();
+    u8 start_neighbors = processor_.GetNeighborMask(start);
+
+    for (std::size_t i = tree_path.size(); i-- > 0;) {
+      NodePoint point = tree_path[i];
+      int dx = point.x - start.x;
+      int dy = point.y - start.y;
+
+      if (dx == 0 && dy == 0) {
+        reuse_index = i;
+        break;
+      }
+
+      if (std::abs(dx) > kPathReuseDistance || std::abs(dy) > kPathReuseDistance) continue;
+
+      for (std::size_t direction = 0; direction < 8; ++direction) {
+        if (kNeighborOffsets[direction][0] == dx && kNeighborOffsets[direction][1] == dy &&
+            (start_neighbors & (1 << direction))) {
+          reuse_index = i;
+          break;
+        }
+      }
+
+      if (reuse_index != tree_path.size()) break;
+    }
+
+    if (reuse_index != tree_path.size()) {
+      if (!(tree_path[reuse_index] == start)) {
+        path.push_back(start);
+      }
+
+      path.insert(path.end(), tree_path.begin() + reuse_index, tree_path.end());
+      return true;
+    }
+
+    // The bot left the tree's path, so start over with a tree rooted at the bot.
+    Reset();
+    Initialize(start);
+  }
+
+  return true;
+}
+
+void IncrementalPlanner::Reset() {
+  for (u32 index : touched_) {
+    nodes_[index] = PlanNode{kInfinity, kInfinity, Node::kInvalidHeapIndex, kNoParent};
+  }
+
+  touched_.clear();
+  heap_.clear();
+  hazards_.clear();
+  initialized_ = false;
+}
+
+void IncrementalPlanner::UpdateTiles(int min_x, int min_y, int max_x, int max_y) {
+  if (!initialized_) return;
+
+  // The tree can't be repaired without its root, so it gets rebuilt from the bot on the next plan.
+  if (!processor_.IsPathable(root_)) {
+    Reset();
+    return;
+  }
+
+  min_x = std::max(min_x, 0);
+  min_y = std::max(min_y, 0);
+  max_x = std::min(max_x, 1023);
+  max_y = std::min(max_y, 1023);
+
+  // The costs and edges only changed inside of the area, so those are the only tiles whose rhs can change.
+  for (int y = min_y; y <= max_y; ++y) {
+    for (int x = min_x; x <= max_x; ++x) {
+      u32 index = GetIndex(NodePoint((u16)x, (u16)y));
+
+      UpdateRhs(index);
+      UpdateVertex(index);
+    }
+  }
+}
+
+void IncrementalPlanner::Initialize(NodePoint root) {
+  root_ = root;
+  goal_ = root;
+  initialized_ = true;
+
+  u32 index = GetIndex(root);
+
+  Touch(index).rhs = 0.0f;
+  HeapPush(index, CalculateKey(index));
+}
+
+void IncrementalPlanner::SetGoal(NodePoint goal) {
+  if (goal == goal_) return;
+
+  goal_ = goal;
+
+  // Only the heuristic depends on the goal, so the open set keeps the same nodes and only needs its keys rebuilt.
+  for (std::size_t i = 0; i < heap_.size(); ++i) {
+    heap_[i].key = CalculateKey(heap_[i].index);
+  }
+
+  for (std::size_t i = heap_.size() / 2; i-- > 0;) {
+    SiftDown(i);
+  }
+}
+
+void IncrementalPlanner::UpdateHazards() {
+  std::vector<u32> hazards;
+
+  for (NodePoint point : processor_.GetHazards()) {
+    hazards.push_back(GetIndex(point));
+  }
+
+  std::sort(hazards.begin(), hazards.end());
+  hazards.erase(std::unique(hazards.begin(), hazards.end()), hazards.end());
+
+  std::vector<u32> changed;
+
+  std::set_symmetric_difference(hazards_.begin(), hazards_.end(), hazards.begin(), hazards.end(),
+                                std::back_inserter(changed));
+
+  // The cost of a tile is only used by the edges that move onto it, so only its own rhs can change.
+  for (u32 index : changed) {
+    if (processor_.IsPathable(GetPointFromIndex(index))) {
+      UpdateRhs(index);
+      UpdateVertex(index);
+    }
+  }
+
+  hazards_ = std::move(hazards);
+}
+
+void IncrementalPlanner::ComputeShortestPath() {
+  u32 goal_index = GetIndex(goal_);
+
+  while (!heap_.empty()) {
+    PlanNode& goal = nodes_[goal_index];
+
+    if (!(heap_[0].key < CalculateKey(goal_index)) && goal.rhs == goal.g) break;
+
+    u32 index = HeapPop();
+    PlanNode& node = nodes_[index];
+    NodePoint point = GetPointFromIndex(index);
+    u8 neighbors = processor_.GetNeighborMask(point);
+
+    ++nodes_expanded_;
+
+    if (node.g > node.rhs) {
+      node.g = node.rhs;
+
+      for (std::size_t i = 0; i < 8; ++i) {
+        if (!(neighbors & (1 << i))) continue;
+
+        u32 neighbor_index = GetIndex(
+            NodePoint(point.x + kNeighborOffsets[i][0], point.y + kNeighborOffsets[i][1]));
+        float cost = node.g + GetEdgeCost(neighbor_index, i);
+        PlanNode& neighbor = Touch(neighbor_index);
+
+        if (cost < neighbor.rhs) {
+          neighbor.rhs = cost;
+          neighbor.parent = index;
+          UpdateVertex(neighbor_index);
+        }
+      }
+    } else {
+      node.g = kInfinity;
+      UpdateRhs(index);
+      UpdateVertex(index);
+
+      for (std::size_t i = 0; i < 8; ++i) {
+        if (!(neighbors & (1 << i))) continue;
+
+        u32 neighbor_index = GetIndex(
+            NodePoint(point.x + kNeighborOffsets[i][0], point.y + kNeighborOffsets[i][1]));
+
+        if (nodes_[neighbor_index].parent == index) {
+          UpdateRhs(neighbor_index);
+          UpdateVertex(neighbor_index);
+        }
+      }
+    }
+  }
+}
+
+void IncrementalPlanner::UpdateVertex(u32 index) {
+  PlanNode& node = Touch(index);
+
+  if (node.g != node.rhs) {
+    Key key = CalculateKey(index);
+
+    if (node.heap_index != Node::kInvalidHeapIndex) {
+      HeapUpdate(index, key);
+    } else {
+      HeapPush(index, key);
+    }
+  } else if (node.heap_index != Node::kInvalidHeapIndex) {
+    HeapRemove(index);
+  }
+}
+
+void IncrementalPlanner::UpdateRhs(u32 index) {
+  if (index == GetIndex(root_)) return;
+
+  PlanNode& node = Touch(index);
+  NodePoint point = GetPointFromIndex(index);
+  u8 neighbors = processor_.GetNeighborMask(point);
+
+  node.rhs = kInfinity;
+  node.parent = kNoParent;
+
+  // Solid tiles still have a mask of the neighbors around them, but nothing can move onto them.
+  if (!processor_.IsPathable(point)) return;
+
+  // Neighbors are symmetric between pathable tiles, so the neighbors that can be moved to are also the ones that
+  // can move onto this tile.
+  for (std::size_t i = 0; i < 8; ++i) {
+    if (!(neighbors & (1 << i))) continue;
+
+    u32 neighbor_index =
+        GetIndex(NodePoint(point.x + kNeighborOffsets[i][0], point.y + kNeighborOffsets[i][1]));
+    float cost = nodes_[neighbor_index].g + GetEdgeCost(index, i);
+
+    if (cost < node.rhs) {
+      node.rhs = cost;
+      node.parent = neighbor_index;
+    }
+  }
+}
+
+IncrementalPlanner::Key IncrementalPlanner::CalculateKey(u32 index) const {
+  const PlanNode& node = nodes_[index];
+  NodePoint point = GetPointFromIndex(index);
+
+  float dx = (float)(point.x - goal_.x);
+  float dy = (float)(point.y - goal_.y);
+  float g = std::min(node.g, node.rhs);
+
+  return Key{g + std::sqrt(dx * dx + dy * dy), g};
+}
+
+float IncrementalPlanner::GetEdgeCost(u32 to, std::size_t direction) const {
+  float cost = std::max(processor_.GetCost(GetPointFromIndex(to)), 1.0f);
+
+  return direction >= 4 ? cost * 1.41421356f : cost;
+}
+
+IncrementalPlanner::PlanNode& IncrementalPlanner::Touch(u32 index) {
+  PlanNode& node = nodes_[index];
+
+  if (node.g == kInfinity && node.rhs == kInfinity && node.parent == kNoParent) {
+    touched_.push_back(index);
+  }
+
+  return node;
+}
+
+void IncrementalPlanner::HeapPush(u32 index, Key key) {
+  heap_.push_back(HeapEntry{key, index});
+  nodes_[index].heap_index = (u32)(heap_.size() - 1);
+  SiftUp(heap_.size() - 1);
+}
+
+void IncrementalPlanner::HeapRemove(u32 index) {
+  std::size_t slot = nodes_[index].heap_index;
+  HeapEntry last = heap_.back();
+
+  nodes_[index].heap_index = Node::kInvalidHeapIndex;
+  heap_.pop_back();
+
+  if (slot == heap_.size()) return;
+
+  Place(slot, last);
+  SiftUp(slot);
+  SiftDown(nodes_[last.index].heap_index);
+}
+
+void IncrementalPlanner::HeapUpdate(u32 index, Key key) {
+  std::size_t slot = nodes_[index].heap_index;
+
+  heap_[slot].key = key;
+  SiftUp(slot);
+  SiftDown(nodes_[index].heap_index);
+}
+
+u32 IncrementalPlanner::HeapPop() {
+  u32 index = heap_[0].index;
+
+  HeapRemove(index);
+
+  return index;
+}
+
+void IncrementalPlanner::SiftUp(std::size_t slot) {
+  HeapEntry entry = heap_[slot];
+
+  while (slot > 0) {
+    std::size_t parent = (slot - 1) / 2;
+
+    if (!(entry.key < heap_[parent].key)) break;
+
+    Place(slot, heap_[parent]);
+    slot = parent;
+  }
+
+  Place(slot, entry);
+}
+
+void IncrementalPlanner::SiftDown(std::size_t slot) {
+  HeapEntry entry = heap_[slot];
+  std::size_t size = heap_.size();
+
+  while (true) {
+    std::size_t child = slot * 2 + 1;
+
+    if (child >= size) break;
+
+    if (child + 1 < size && heap_[child + 1].key < heap_[child].key) {
+      ++child;
+    }
+
+    if (!(heap_[child].key < entry.key)) break;
+
+    Place(slot, heap_[child]);
+    slot = child;
+  }
+
+  Place(slot, entry);
+}
+
+}  // namespace path
+}  // namespace marvin
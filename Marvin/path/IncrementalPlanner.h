@@ -0,0 +1,99 @@
+#pragma once
+
+#include <vector>
+
+#include "NodeProcessor.h"
+
+namespace marvin {
+namespace path {
+
+// Lifelong Planning A* that keeps its search tree between calls so a path to a moving target only repairs the part
+// of the tree that changed.
+// The tree is rooted at the position of the bot when it was created. Moving the goal only changes the heuristic, so
+// the nodes that were already settled are kept and the search continues from the old open set. The bot is expected
+// to follow the path, so any path it still stands on is reused by returning the rest of it from the bot's tile.
+// Changes to the hazard overlay are repaired by updating the tiles whose costs changed.
+//
+// The cost of entering a tile is never less than 1 so the euclidean heuristic is consistent, which the repairs need
+// to stay correct. This prefers shorter paths through the open areas than FindPath does.
+class IncrementalPlanner {
+ public:
+  IncrementalPlanner(NodeProcessor& processor) : processor_(processor) {}
+
+  // Finds the path of tiles from start to goal using the hazards stamped in the processor. Returns false if the
+  // planner can't be used for the request and a normal search should be done instead.
+  bool Plan(NodePoint start, NodePoint goal, std::vector<NodePoint>& path);
+
+  // Drops the search tree. This needs to be called whenever the static weights or pathable flags change.
+  void Reset();
+  // Repairs the search tree after the static weights or pathable flags changed inside of the area.
+  void UpdateTiles(int min_x, int min_y, int max_x, int max_y);
+
+  // The number of nodes expanded during the last call to Plan.
+  std::size_t GetNodesExpanded() const { return nodes_expanded_; }
+
+ private:
+  struct PlanNode {
+    float g;
+    float rhs;
+    u32 heap_index;
+    // The neighbor that the rhs value was taken from.
+    u32 parent;
+  };
+
+  struct Key {
+    float first;
+    float second;
+
+    bool operator<(const Key& other) const {
+      return first < other.first || (first == other.first && second < other.second);
+    }
+  };
+
+  struct HeapEntry {
+    Key key;
+    u32 index;
+  };
+
+  void Initialize(NodePoint root);
+  void SetGoal(NodePoint goal);
+  void UpdateHazards();
+  void ComputeShortestPath();
+
+  void UpdateVertex(u32 index);
+  // Recalculates rhs from the neighbors of the tile.
+  void UpdateRhs(u32 index);
+  Key CalculateKey(u32 index) const;
+  float GetEdgeCost(u32 to, std::size_t direction) const;
+  PlanNode& Touch(u32 index);
+
+  void HeapPush(u32 index, Key key);
+  void HeapRemove(u32 index);
+  void HeapUpdate(u32 index, Key key);
+  u32 HeapPop();
+  void SiftUp(std::size_t slot);
+  void SiftDown(std::size_t slot);
+  inline void Place(std::size_t slot, const HeapEntry& entry) {
+    heap_[slot] = entry;
+    nodes_[entry.index].heap_index = (u32)slot;
+  }
+
+  NodeProcessor& processor_;
+
+  bool initialized_ = false;
+  NodePoint root_;
+  NodePoint goal_;
+
+  // Allocated on first use since most bots never chase anything.
+  std::vector<PlanNode> nodes_;
+  // Every node that was changed since the last reset, so a reset doesn't need to clear the whole map.
+  std::vector<u32> touched_;
+  std::vector<HeapEntry> heap_;
+  // Sorted tile indexes of the hazards that were included in the tree.
+  std::vector<u32> hazards_;
+
+  std::size_t nodes_expanded_ = 0;
+};
+
+}  // namespace path
+}  // namespace marvin
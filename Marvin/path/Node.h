@@ -17,33 +17,46 @@ struct NodePoint {
   bool operator==(const NodePoint& other) const { return x == other.x && y == other.y; }
 };
 
-enum { NodeFlag_Openset = (1 << 0), NodeFlag_Closed = (1 << 1), NodeFlag_Initialized = (1 << 2) };
+enum { NodeFlag_Openset = (1 << 0), NodeFlag_Closed = (1 << 1) };
 typedef u32 NodeFlags;
 
-struct Node {
-  Node* parent;
+// Static data about the tile that doesn't change during a search.
+enum { TileFlag_Pathable = (1 << 0), TileFlag_Occupiable = (1 << 1) };
+typedef u8 TileFlags;
 
+// Only the fields that change during a search are stored in the node so it fits in 12 bytes. The weights and tile
+// flags are stored in separate arrays in the NodeProcessor.
+struct Node {
   float g;
-  float f;
-
-  float weight;
-  float previous_weight;
-
-  bool is_pathable;
-  bool can_occupy;
-
-  u8 flags;
-
-  Node()
-      : flags(0),
-        parent(nullptr),
-        g(0.0f),
-        f(0.0f),
-        weight(1.0f),
-        previous_weight(1.0f),
-        is_pathable(false),
-        can_occupy(false)
-  {}
+
+  // The slot of this node in the open set heap. The f value is stored in the heap entry.
+  u32 heap_index;
+
+  // The parent index is stored in the low 20 bits, followed by 2 bits of node flags. A node with itself as the
+  // parent has no parent. The search generation that last reset the node is stored in the NodeProcessor.
+  u32 state;
+
+  static constexpr u32 kParentBits = 20;
+
+  static constexpr u32 kParentMask = (1 << kParentBits) - 1;
+  static constexpr u32 kFlagShift = kParentBits;
+  static constexpr u32 kInvalidHeapIndex = 0xFFFFFFFF;
+
+  Node() : g(0.0f), heap_index(kInvalidHeapIndex), state(0) {}
+
+  inline u32 GetParentIndex() const { return state & kParentMask; }
+  inline void SetParentIndex(u32 index) { state = (state & ~kParentMask) | index; }
+
+  inline bool HasFlag(NodeFlags flag) const { return (state >> kFlagShift) & flag; }
+  inline void SetFlag(NodeFlags flag) { state |= flag << kFlagShift; }
+  inline void ClearFlag(NodeFlags flag) { state &= ~(flag << kFlagShift); }
+
+  // Resets the search fields.
+  inline void Reset(u32 index) {
+    g = 0.0f;
+    heap_index = kInvalidHeapIndex;
+    state = index;
+  }
 };
 
 }  // namespace path
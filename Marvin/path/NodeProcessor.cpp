@@ -1,121 +1,429 @@
 #include "NodeProcessor.h"
 
+#include <algorithm>
+#include <cmath>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #include "../Debug.h"
+#include "../MapCache.h"
 
 namespace marvin {
 namespace path {
 
-bool NodeProcessor::Mined(std::vector<Vector2f> mines, NodePoint point) {
-  if (mines.empty()) {
-    return false;
+enum {
+  Neighbor_North = (1 << 0),
+  Neighbor_South = (1 << 1),
+  Neighbor_West = (1 << 2),
+  Neighbor_East = (1 << 3),
+  Neighbor_NorthWest = (1 << 4),
+  Neighbor_SouthWest = (1 << 5),
+  Neighbor_NorthEast = (1 << 6),
+  Neighbor_SouthEast = (1 << 7),
+};
+
+NodeConnections NodeProcessor::FindEdges(Node* node) {
+  NodeConnections connections;
+  connections.count = 0;
+
+  NodePoint base_point = GetPoint(node);
+  u8 neighbors = neighbor_masks_[base_point.y * 1024 + base_point.x];
+
+  for (std::size_t i = 0; i < 8; ++i) {
+    if (!(neighbors & (1 << i))) continue;
+
+    NodePoint current_point(base_point.x + kNeighborOffsets[i][0], base_point.y + kNeighborOffsets[i][1]);
+    connections.neighbors[connections.count] = GetNode(current_point);
+    connections.costs[connections.count] = GetCost(current_point) * (i >= 4 ? 1.41421356f : 1.0f);
+    ++connections.count;
   }
 
-  for (std::size_t i = 0; i < mines.size(); i++) {
-    NodePoint np;
-    np.x = (uint16_t)mines[i].x;
-    np.y = (uint16_t)mines[i].y;
+  return connections;
+}
 
-    if (np.x - 1 == point.x || np.x == point.x || np.x + 1 == point.x) {
-      if (np.y - 1 == point.y || np.y == point.y || np.y + 1 == point.y) {
-        return true;
+void NodeProcessor::UpdateNeighborMasks() {
+  UpdateNeighborMasks(0, 0, 1023, 1023);
+}
+
+void NodeProcessor::UpdateNeighborMasks(int min_x, int min_y, int max_x, int max_y) {
+  min_x = std::max(min_x, 0);
+  min_y = std::max(min_y, 0);
+  max_x = std::min(max_x, 1023);
+  max_y = std::min(max_y, 1023);
+
+  for (u16 y = (u16)min_y; y <= max_y; ++y) {
+    for (u16 x = (u16)min_x; x <= max_x; ++x) {
+      u8 neighbors = 0;
+
+      for (std::size_t i = 0; i < 4; ++i) {
+        u16 world_x = x + kNeighborOffsets[i][0];
+        u16 world_y = y + kNeighborOffsets[i][1];
+
+        if (map_.IsSolid(world_x, world_y)) continue;
+
+        if (IsPathable(NodePoint(world_x, world_y))) {
+          neighbors |= (1 << i);
+        }
+      }
+
+      /* There are some cases where the ship can path into a node diagonally but should not (diagonal gaps)
+         when finding edges, only allow diagonal movement if both of the other sides can be pathed on
+
+         note: there are some cases where it would be safe to path diagonally if only one side is pathable,
+         this method ignores those cases.
+      */
+      if ((neighbors & Neighbor_North) && (neighbors & Neighbor_West) && CanStepOn(x - 1, y - 1)) {
+        neighbors |= Neighbor_NorthWest;
+      }
+
+      if ((neighbors & Neighbor_South) && (neighbors & Neighbor_West) && CanStepOn(x - 1, y + 1)) {
+        neighbors |= Neighbor_SouthWest;
+      }
+
+      if ((neighbors & Neighbor_North) && (neighbors & Neighbor_East) && CanStepOn(x + 1, y - 1)) {
+        neighbors |= Neighbor_NorthEast;
+      }
+
+      if ((neighbors & Neighbor_South) && (neighbors & Neighbor_East) && CanStepOn(x + 1, y + 1)) {
+        neighbors |= Neighbor_SouthEast;
       }
+
+      neighbor_masks_[y * 1024 + x] = neighbors;
     }
   }
-
-  return false;
 }
 
-NodeConnections NodeProcessor::FindEdges(std::vector<Vector2f> mines, Node* node, Node* start, Node* goal) {
-  /* There are some cases where the ship can path into a node diagonally but should not (diagonal gaps)
-     when finding edges, only allow diagonal movement if both of the other sides can be pathed on
-
-     note: there are some cases where it would be safe to path diagonally if only one side is pathable,
-     this method ignores those cases.
-  */
+NodeConnections NodeProcessor::FindJumpEdges(Node* node, Node* goal) {
   NodeConnections connections;
   connections.count = 0;
 
-  NodePoint base_point = GetPoint(node);
+  NodePoint point = GetPoint(node);
+  NodePoint goal_point = GetPoint(goal);
+
+  // Nodes in the open are pruned by the direction they were entered from. Nodes near walls have no parent
+  // direction to rely on because the weights change from tile to tile, so every direction gets searched.
+  Node* parent = GetParent(node);
+  bool prune = parent != nullptr && IsUniform(point.x, point.y);
+  int parent_dx = 0;
+  int parent_dy = 0;
+
+  if (prune) {
+    NodePoint parent_point = GetPoint(parent);
+
+    parent_dx = (point.x > parent_point.x) - (point.x < parent_point.x);
+    parent_dy = (point.y > parent_point.y) - (point.y < parent_point.y);
+  }
+
+  for (int dy = -1; dy <= 1; ++dy) {
+    for (int dx = -1; dx <= 1; ++dx) {
+      if (dx == 0 && dy == 0) continue;
+      if (!CanStep(point.x, point.y, dx, dy)) continue;
+
+      // Weighted neighbors are always searched so the tiles along the edge of the open area get expanded.
+      if (prune && IsUniform(point.x + dx, point.y + dy)) {
+        bool natural = false;
+
+        if (parent_dx != 0 && parent_dy != 0) {
+          natural = (dx == 0 || dx == parent_dx) && (dy == 0 || dy == parent_dy);
+        } else if (parent_dx != 0) {
+          natural = dx != -parent_dx;
+        } else {
+          natural = dy != -parent_dy;
+        }
+
+        if (!natural) continue;
+      }
+
+      NodePoint jump_point;
+
+      if (!Jump(point.x, point.y, dx, dy, goal_point, &jump_point)) continue;
+
+      Node* edge = GetNode(jump_point);
+
+      // Every tile that was jumped over has the same uniform weight, so only the last step can cost more.
+      int steps = std::max(std::abs(jump_point.x - point.x), std::abs(jump_point.y - point.y));
+      float step_length = (dx != 0 && dy != 0) ? 1.41421356f : 1.0f;
+      float cost = GetCost(jump_point) * step_length;
+
+      if (steps > 1) {
+        cost += GetCost(NodePoint(jump_point.x - dx, jump_point.y - dy)) * step_length * (steps - 1);
+      }
+
+      connections.neighbors[connections.count] = edge;
+      connections.costs[connections.count] = cost;
+      ++connections.count;
+    }
+  }
+
+  return connections;
+}
+
+/* Walks from x, y in one direction until it finds a tile that needs to be expanded. This is the goal, the first
+   weighted tile, or a tile with a forced neighbor. Every diagonal step probes straight out along both axes and
+   stops if either of them finds something. */
+bool NodeProcessor::Jump(int x, int y, int dx, int dy, NodePoint goal, NodePoint* result) const {
+  if (dx == 0 || dy == 0) {
+    int position = 0;
+    bool found = false;
+
+    if (dy == 0) {
+      found = JumpStraight(GetRow(y - 1), GetRow(y), GetRow(y + 1), x, dx, goal.y == y ? goal.x : -1, false,
+                           &position);
+      *result = NodePoint((uint16_t)position, (uint16_t)y);
+    } else {
+      found = JumpStraight(GetColumn(x - 1), GetColumn(x), GetColumn(x + 1), y, dy, goal.x == x ? goal.y : -1,
+                           false, &position);
+      *result = NodePoint((uint16_t)x, (uint16_t)position);
+    }
+
+    return found;
+  }
 
-  bool north = false;
-  bool south = false;
+  while (true) {
+    if (!CanStep(x, y, dx, dy)) return false;
 
-  // start by looping through sides first
+    // Stepping diagonally past a weighted tile is allowed by FindEdges, but the tiles around it aren't uniform.
+    bool cut_corner = !IsUniform(x + dx, y) || !IsUniform(x, y + dy);
 
-  Vector2f pos;
-  std::vector<Vector2f> neighbors{North(pos), South(pos), West(pos), East(pos)};
+    x += dx;
+    y += dy;
 
-  // for (int y = -1; y <= 1; ++y) {
-  // for (int x = -1; x <= 1; ++x) {
-  //   if (x == 0 && y == 0) {
-  //     continue;
-  //   }
+    *result = NodePoint((uint16_t)x, (uint16_t)y);
 
-  for (std::size_t i = 0; i < neighbors.size(); i++) {
+    if (x == goal.x && y == goal.y) return true;
+    if (!IsUniform(x, y) || cut_corner) return true;
 
-    uint16_t world_x = base_point.x + (uint16_t)neighbors[i].x;
-    uint16_t world_y = base_point.y + (uint16_t)neighbors[i].y;
+    int position = 0;
 
-    // uint16_t world_x = base_point.x + x;
-    // uint16_t world_y = base_point.y + y;
+    if (JumpStraight(GetRow(y - 1), GetRow(y), GetRow(y + 1), x, dx, goal.y == y ? goal.x : -1, true, &position)) {
+      return true;
+    }
 
-    if (map_.IsSolid(world_x, world_y)) {
-      continue;
+    if (JumpStraight(GetColumn(x - 1), GetColumn(x), GetColumn(x + 1), y, dy, goal.x == x ? goal.y : -1, true,
+                     &position)) {
+      return true;
     }
+  }
+}
+
+// Returns 64 bits of a line starting at the tile position. Tiles outside of the map are zero.
+inline u64 GetLineBits(const u64* words, int position) {
+  int word = position >= 0 ? position / 64 : -1;
+  int offset = position - word * 64;
+
+  u64 low = (word >= 0 && word < 16) ? words[word] : 0;
+  u64 high = (word + 1 >= 0 && word + 1 < 16) ? words[word + 1] : 0;
+
+  if (offset == 0) return low;
+
+  return (low >> offset) | (high << (64 - offset));
+}
+
+inline int FindLowestBit(u64 value) {
+#ifdef _MSC_VER
+  unsigned long index = 0;
+
+  if (_BitScanForward(&index, (unsigned long)value)) return (int)index;
+
+  _BitScanForward(&index, (unsigned long)(value >> 32));
+  return (int)index + 32;
+#else
+  return __builtin_ctzll(value);
+#endif
+}
+
+inline int FindHighestBit(u64 value) {
+#ifdef _MSC_VER
+  unsigned long index = 0;
+
+  if (_BitScanReverse(&index, (unsigned long)(value >> 32))) return (int)index + 32;
+
+  _BitScanReverse(&index, (unsigned long)value);
+  return (int)index;
+#else
+  return 63 - __builtin_clzll(value);
+#endif
+}
+
+/* Scans a row or column for the first tile that stops a straight jump. A side tile is forced when it can only be
+   reached through the current tile, because the tile behind it is not uniform. Weighted side tiles are always
+   forced so the search falls back to A* along the edge of the open area.
+
+   Probes only report whether the diagonal step they came from is a jump point, so they stop without a result when
+   they run into the weighted area. */
+bool NodeProcessor::JumpStraight(const JumpLine& side1, const JumpLine& line, const JumpLine& side2, int position,
+                                 int direction, int goal_position, bool probe, int* result) const {
+  int start = direction > 0 ? position + 1 : position - 64;
+
+  while (true) {
+    u64 uniform = GetLineBits(line.uniform, start);
+    u64 pathable = GetLineBits(line.pathable, start);
 
-    Vector2f check_pos(world_x, world_y);
+    u64 side1_uniform = GetLineBits(side1.uniform, start);
+    u64 side1_behind = GetLineBits(side1.uniform, start - direction);
+    u64 side2_uniform = GetLineBits(side2.uniform, start);
+    u64 side2_behind = GetLineBits(side2.uniform, start - direction);
 
-    //if (!map_.CanPathOn(check_pos, radius)) continue;
+    u64 forced = (side1_uniform & ~side1_behind) | (GetLineBits(side1.pathable, start) & ~side1_uniform) |
+                 (side2_uniform & ~side2_behind) | (GetLineBits(side2.pathable, start) & ~side2_uniform);
 
-    NodePoint current_point(world_x, world_y);
-    Node* current = GetNode(current_point);
+    u64 goal = 0;
 
-    if (current) {
-      if (!current->is_pathable) {
-        continue;
-      } else if (Mined(mines, current_point)) {
-        current->weight = 100.0f;
-      } else if (map_.GetTileId(current_point.x, current_point.y) == kSafeTileId) {
-        current->weight = 10.0f;
-      } else if (current->weight != current->previous_weight) {
-        current->weight = current->previous_weight;
+    if (goal_position >= start && goal_position < start + 64) {
+      goal = (u64)1 << (goal_position - start);
+    }
+
+    u64 stop = ~uniform | forced | (goal & pathable);
+
+    if (direction > 0) {
+      // The first window begins after the starting position, so only the positions ahead of it are scanned.
+      if (stop != 0) {
+        int bit = FindLowestBit(stop);
+        u64 mask = (u64)1 << bit;
+
+        *result = start + bit;
+
+        if (!(pathable & mask)) return false;
+        if (*result == goal_position) return true;
+        if (!(uniform & mask)) return !probe;
+
+        return true;
       }
+
+      start += 64;
+    } else {
+      if (stop != 0) {
+        int bit = FindHighestBit(stop);
+        u64 mask = (u64)1 << bit;
+
+        *result = start + bit;
+
+        if (!(pathable & mask)) return false;
+        if (*result == goal_position) return true;
+        if (!(uniform & mask)) return !probe;
+
+        return true;
+      }
+
+      start -= 64;
     }
+  }
+}
+
+NodeProcessor::JumpLine NodeProcessor::GetRow(int y) const {
+  static const u64 kEmptyLine[kMaskWords] = {};
+
+  if (y < 0 || y >= 1024) return JumpLine{kEmptyLine, kEmptyLine};
+
+  return JumpLine{&uniform_rows_[y * kMaskWords], &pathable_rows_[y * kMaskWords]};
+}
+
+NodeProcessor::JumpLine NodeProcessor::GetColumn(int x) const {
+  static const u64 kEmptyLine[kMaskWords] = {};
+
+  if (x < 0 || x >= 1024) return JumpLine{kEmptyLine, kEmptyLine};
+
+  return JumpLine{&uniform_columns_[x * kMaskWords], &pathable_columns_[x * kMaskWords]};
+}
 
-    connections.neighbors[connections.count++] = current;
+void NodeProcessor::UpdateJumpMasks() {
+  UpdateJumpMasks(0, 0, 1023, 1023);
+}
+
+void NodeProcessor::UpdateJumpMasks(int min_x, int min_y, int max_x, int max_y) {
+  min_x = std::max(min_x, 0);
+  min_y = std::max(min_y, 0);
+  max_x = std::min(max_x, 1023);
+  max_y = std::min(max_y, 1023);
 
-    if (connections.count >= 8) {
-      return connections;
+  for (u16 y = (u16)min_y; y <= max_y; ++y) {
+    for (u16 x = (u16)min_x; x <= max_x; ++x) {
+      SetMaskBit(x, y, IsStaticUniform(x, y), IsPathable(NodePoint(x, y)));
     }
+  }
+}
 
-    // if a side node gets pushed into the connections, check which node and add diagonal neighbors
-    switch (i) {
-      case 0: {
-        north = true;
-      } break;
-      case 1: {
-        south = true;
-      } break;
-      case 2: {
-        if (north == true) {
-          neighbors.push_back(NorthWest(pos));
-        }
-        if (south == true) {
-          neighbors.push_back(SouthWest(pos));
-        }
-      } break;
-      case 3: {
-        if (north == true) {
-          neighbors.push_back(NorthEast(pos));
-        }
-        if (south == true) {
-          neighbors.push_back(SouthEast(pos));
-        }
-      } break;
+void NodeProcessor::SetHazards(const std::vector<Vector2f>& mines) {
+  for (const Vector2f& mine : mines) {
+    for (int y = -1; y <= 1; ++y) {
+      for (int x = -1; x <= 1; ++x) {
+        NodePoint point((uint16_t)(mine.x + x), (uint16_t)(mine.y + y));
+
+        if (point.x >= 1024 || point.y >= 1024) continue;
+
+        hazard_costs_[point.y * 1024 + point.x] = kMineCost;
+        // Mined tiles aren't uniform anymore, so jumps need to stop at them.
+        SetMaskBit(point.x, point.y, false, IsPathable(point));
+        hazards_.push_back(point);
+      }
     }
   }
-      // }
-      return connections;
+}
+
+void NodeProcessor::ClearHazards() {
+  for (NodePoint point : hazards_) {
+    hazard_costs_[point.y * 1024 + point.x] = 0;
+    SetMaskBit(point.x, point.y, IsStaticUniform(point.x, point.y), IsPathable(point));
+  }
+
+  hazards_.clear();
+}
+
+void NodeProcessor::SetMaskBit(u16 x, u16 y, bool uniform, bool pathable) {
+  u64 row_bit = (u64)1 << (x % 64);
+  u64 column_bit = (u64)1 << (y % 64);
+  std::size_t row_index = y * kMaskWords + x / 64;
+  std::size_t column_index = x * kMaskWords + y / 64;
+
+  if (uniform) {
+    uniform_rows_[row_index] |= row_bit;
+    uniform_columns_[column_index] |= column_bit;
+  } else {
+    uniform_rows_[row_index] &= ~row_bit;
+    uniform_columns_[column_index] &= ~column_bit;
+  }
+
+  if (pathable) {
+    pathable_rows_[row_index] |= row_bit;
+    pathable_columns_[column_index] |= column_bit;
+  } else {
+    pathable_rows_[row_index] &= ~row_bit;
+    pathable_columns_[column_index] &= ~column_bit;
+  }
+}
+
+// Uniform tiles are the open tiles that still have the default weight because no wall or safe tile raised it
+// above 1 in CreateMapWeights.
+bool NodeProcessor::IsStaticUniform(u16 x, u16 y) const {
+  NodePoint point(x, y);
+
+  return IsPathable(point) && GetWeight(point) <= 1.0f;
+}
+
+bool NodeProcessor::IsUniform(int x, int y) const {
+  if (x < 0 || y < 0 || x >= 1024 || y >= 1024) return false;
+
+  return (uniform_rows_[y * kMaskWords + x / 64] >> (x % 64)) & 1;
+}
+
+bool NodeProcessor::IsPathable(int x, int y) const {
+  if (x < 0 || y < 0 || x >= 1024 || y >= 1024) return false;
+
+  return (pathable_rows_[y * kMaskWords + x / 64] >> (x % 64)) & 1;
+}
+
+// Uses the same diagonal rule as FindEdges, diagonal steps need both of the side tiles to be pathable.
+bool NodeProcessor::CanStep(int x, int y, int dx, int dy) const {
+  if (!IsPathable(x + dx, y + dy)) return false;
+  if (dx == 0 || dy == 0) return true;
+
+  return IsPathable(x + dx, y) && IsPathable(x, y + dy);
+}
+
+bool NodeProcessor::CanStepOn(u16 x, u16 y) const {
+  return !map_.IsSolid(x, y) && IsPathable(NodePoint(x, y));
 }
 
 Node* NodeProcessor::GetNode(NodePoint point) {
@@ -123,16 +431,53 @@ Node* NodeProcessor::GetNode(NodePoint point) {
     return nullptr;
   }
 
-  std::size_t index = point.y * 1024 + point.x;
-  Node* node = &nodes_[index];
+  return nodes_->Get(point.y * 1024 + point.x);
+}
+
+Node* NodeProcessor::GetParent(const Node* node) {
+  u32 index = (u32)nodes_->GetIndex(node);
+  u32 parent_index = node->GetParentIndex();
+
+  if (parent_index == index) return nullptr;
+
+  return &nodes_->nodes[parent_index];
+}
+
+void NodeProcessor::SetWeight(NodePoint point, float weight) {
+  std::size_t palette_index = 0;
+
+  for (; palette_index < weight_palette_.size(); ++palette_index) {
+    if (weight_palette_[palette_index] == weight) break;
+  }
+
+  if (palette_index == weight_palette_.size()) {
+    if (weight_palette_.size() < 256) {
+      weight_palette_.push_back(weight);
+    } else {
+      // The palette is full, so use the closest weight that exists.
+      palette_index = 0;
 
-  if (!(node->flags & NodeFlag_Initialized)) {
-    node->g = node->f = 0.0f;
-    node->flags = NodeFlag_Initialized;
-    node->parent = nullptr;
+      for (std::size_t i = 1; i < weight_palette_.size(); ++i) {
+        if (std::abs(weight_palette_[i] - weight) < std::abs(weight_palette_[palette_index] - weight)) {
+          palette_index = i;
+        }
+      }
+    }
   }
 
-  return &nodes_[index];
+  weight_indices_[point.y * 1024 + point.x] = (u8)palette_index;
+}
+
+void NodeProcessor::SaveTileData(CacheWriter& writer) const {
+  writer.WriteVector(weight_indices_);
+  writer.WriteVector(weight_palette_);
+  writer.WriteVector(tile_flags_);
+}
+
+bool NodeProcessor::LoadTileData(CacheReader& reader) {
+  return reader.ReadVector(weight_indices_) && weight_indices_.size() == kMaxNodes &&
+         reader.ReadVector(weight_palette_) && !weight_palette_.empty() && reader.ReadVector(tile_flags_) &&
+         tile_flags_.size() == kMaxNodes;
 }
 
 }  // namespace path
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <cstring>
 #include <unordered_map>
 #include <vector>
@@ -9,35 +10,147 @@
 #include "Node.h"
 
 namespace marvin {
+
+class CacheReader;
+class CacheWriter;
+
 namespace path {
 
 constexpr std::size_t kMaxNodes = 1024 * 1024;
 
+// The search state of every node. Nodes are reset on their first fetch in each search generation instead of all at
+// once. A sliced search keeps its own set so the searches that run between its calls don't overwrite it.
+struct NodeSet {
+  std::vector<Node> nodes;
+  // The generation of the search that last reset each node. A full 32 bits so the stamps only need to be cleared
+  // after billions of searches.
+  std::vector<u32> generations;
+  // The stamps are zeroed on creation, so the first generation needs to start at 1.
+  u32 generation = 1;
+
+  NodeSet() : nodes(kMaxNodes), generations(kMaxNodes, 0) {}
+
+  // Starts a new search generation. Every node is treated as reset until it's fetched again.
+  void BeginSearch() {
+    if (++generation == 0) {
+      // The generation wrapped around, so old stamps could match again. Clear them all and start over.
+      std::fill(generations.begin(), generations.end(), 0);
+      generation = 1;
+    }
+  }
+
+  inline Node* Get(std::size_t index) {
+    Node* node = &nodes[index];
+
+    if (generations[index] != generation) {
+      generations[index] = generation;
+      node->Reset((u32)index);
+    }
+
+    return node;
+  }
+
+  inline bool IsTouched(std::size_t index) const { return generations[index] == generation; }
+  inline std::size_t GetIndex(const Node* node) const { return node - &nodes[0]; }
+};
+
 struct NodeConnections {
   Node* neighbors[8];
+  // The cost of moving from the expanded node to each neighbor.
+  float costs[8];
   std::size_t count;
 };
 
+// Neighbor offsets in the order that FindEdges returns them. Sides come first so the diagonals can check them.
+constexpr int kNeighborOffsets[8][2] = {{0, -1}, {0, 1}, {-1, 0}, {1, 0}, {-1, -1}, {-1, 1}, {1, -1}, {1, 1}};
+
 // Determines the node edges when using A*.
 class NodeProcessor {
  public:
-  NodeProcessor(GameProxy& game) : game_(game), map_(game.GetMap()) {
-    nodes_.resize(kMaxNodes);
-    memset(&nodes_[0], 0, kMaxNodes * sizeof(Node));
-  }
+  NodeProcessor(GameProxy& game) : NodeProcessor(game, game.GetMap()) {}
+  // Creates the processor for a map other than the one the game has loaded, such as a generated benchmark map.
+  NodeProcessor(GameProxy& game, const Map& map)
+      : map_(map),
+        game_(game),
+        uniform_rows_(1024 * kMaskWords),
+        pathable_rows_(1024 * kMaskWords),
+        uniform_columns_(1024 * kMaskWords),
+        pathable_columns_(1024 * kMaskWords),
+        weight_indices_(kMaxNodes, 0),
+        weight_palette_(1, 0.0f),
+        tile_flags_(kMaxNodes, 0),
+        neighbor_masks_(kMaxNodes, 0),
+        hazard_costs_(kMaxNodes, 0) {}
 
   GameProxy& GetGame() { return game_; }
 
-  bool Mined(std::vector<Vector2f> mines, NodePoint point);
-
-  NodeConnections FindEdges(std::vector<Vector2f> mines, Node* node, Node* start, Node* goal);
+  NodeConnections FindEdges(Node* node);
+  // Finds the edges for jump point search. Open areas with uniform weights are crossed in a single jump, and the
+  // weighted tiles near walls are expanded one tile at a time like FindEdges.
+  NodeConnections FindJumpEdges(Node* node, Node* goal);
   Node* GetNode(NodePoint point);
+  // Returns nullptr if the node has no parent.
+  Node* GetParent(const Node* node);
+  void SetParent(Node* node, const Node* parent) { node->SetParentIndex((u32)nodes_->GetIndex(parent)); }
+  // Starts a new search generation. Every node is treated as reset until it's fetched again.
+  void BeginSearch() { nodes_->BeginSearch(); }
+  // Returns true if the node was fetched since the last BeginSearch.
+  inline bool IsTouched(NodePoint point) const { return nodes_->IsTouched(point.y * 1024 + point.x); }
+  // Searches with the nodes in the set until it's called again. Null returns to the processor's own nodes.
+  void SetNodeSet(NodeSet* nodes) { nodes_ = nodes != nullptr ? nodes : &own_nodes_; }
   bool IsSolid(u16 x, u16 y) { return map_.IsSolid(x, y); }
 
+  // Weights are stored as an index into a small palette since maps only use a few distinct weights.
+  inline float GetWeight(NodePoint point) const { return weight_palette_[weight_indices_[point.y * 1024 + point.x]]; }
+  void SetWeight(NodePoint point, float weight);
+  // Returns the tile to the weight that it has before CreateMapWeights sets it.
+  void ResetWeight(NodePoint point) { weight_indices_[point.y * 1024 + point.x] = 0; }
+
+  inline bool IsPathable(NodePoint point) const { return tile_flags_[point.y * 1024 + point.x] & TileFlag_Pathable; }
+  inline bool CanOccupy(NodePoint point) const { return tile_flags_[point.y * 1024 + point.x] & TileFlag_Occupiable; }
+  inline void SetTileFlag(NodePoint point, TileFlags flag) { tile_flags_[point.y * 1024 + point.x] |= flag; }
+  inline void SetTileFlags(NodePoint point, TileFlags flags) { tile_flags_[point.y * 1024 + point.x] = flags; }
+
+  // Saves and loads the weights and tile flags. The masks need to be updated after loading.
+  void SaveTileData(CacheWriter& writer) const;
+  bool LoadTileData(CacheReader& reader);
+
+  // One bit for each neighbor in kNeighborOffsets that can be moved to from the tile.
+  inline u8 GetNeighborMask(NodePoint point) const { return neighbor_masks_[point.y * 1024 + point.x]; }
+
+  // The raw tile arrays, so they can be copied for work on other threads.
+  const std::vector<u8>& GetWeightIndices() const { return weight_indices_; }
+  const std::vector<float>& GetWeightPalette() const { return weight_palette_; }
+  const std::vector<u8>& GetNeighborMasks() const { return neighbor_masks_; }
+  const std::vector<TileFlags>& GetTileFlags() const { return tile_flags_; }
+  // Rebuilds the mask of neighbors that can be moved to from each tile. This needs to be called after the pathable
+  // flags change.
+  void UpdateNeighborMasks();
+  // Rebuilds the masks of the tiles inside of the area. The area is clamped to the map.
+  void UpdateNeighborMasks(int min_x, int min_y, int max_x, int max_y);
+
+  // Rebuilds the jump masks from the node weights and pathable flags. This needs to be called after either changes.
+  void UpdateJumpMasks();
+  void UpdateJumpMasks(int min_x, int min_y, int max_x, int max_y);
+  // Stamps the tiles around each mine into the hazard overlay for the current search. A hazard cost replaces the
+  // static weight of the tile until the hazards are cleared.
+  void SetHazards(const std::vector<Vector2f>& mines);
+  void ClearHazards();
+  // The tiles that were stamped by the last call to SetHazards.
+  const std::vector<NodePoint>& GetHazards() const { return hazards_; }
+
+  // The cost of moving onto a tile in the current search.
+  inline float GetCost(NodePoint point) const {
+    std::size_t index = point.y * 1024 + point.x;
+    u8 hazard_cost = hazard_costs_[index];
+
+    return hazard_cost != 0 ? (float)hazard_cost : GetWeight(point);
+  }
+
   // Calculate the node from the index.
   // This lets the node exist without storing its position so it fits in cache better.
   inline NodePoint GetPoint(const Node* node) const {
-    size_t index = (node - &nodes_[0]);
+    size_t index = nodes_->GetIndex(node);
 
     uint16_t world_y = (uint16_t)(index / 1024);
     uint16_t world_x = (uint16_t)(index % 1024);
@@ -46,9 +159,52 @@ class NodeProcessor {
   }
 
  private:
-  std::vector<Node> nodes_;
+  // Each row and column of the map is stored as 16 words with one bit per tile. Rows are used for horizontal
+  // jumps and columns for vertical jumps so both can scan 64 tiles at a time.
+  static constexpr std::size_t kMaskWords = 1024 / 64;
+
+  struct JumpLine {
+    const u64* uniform;
+    const u64* pathable;
+  };
+
+  bool IsStaticUniform(u16 x, u16 y) const;
+  bool IsUniform(int x, int y) const;
+  bool IsPathable(int x, int y) const;
+  bool CanStep(int x, int y, int dx, int dy) const;
+  bool CanStepOn(u16 x, u16 y) const;
+
+  JumpLine GetRow(int y) const;
+  JumpLine GetColumn(int x) const;
+  void SetMaskBit(u16 x, u16 y, bool uniform, bool pathable);
+
+  bool Jump(int x, int y, int dx, int dy, NodePoint goal, NodePoint* result) const;
+  bool JumpStraight(const JumpLine& side1, const JumpLine& line, const JumpLine& side2, int position, int direction,
+                    int goal_position, bool probe, int* result) const;
+
   const Map& map_;
   GameProxy& game_;
+
+  std::vector<u64> uniform_rows_;
+  std::vector<u64> pathable_rows_;
+  std::vector<u64> uniform_columns_;
+  std::vector<u64> pathable_columns_;
+
+  // The hot search state is kept separate from the static tile data so the search loop touches less memory.
+  NodeSet own_nodes_;
+  NodeSet* nodes_ = &own_nodes_;
+
+  std::vector<u8> weight_indices_;
+  std::vector<float> weight_palette_;
+  std::vector<TileFlags> tile_flags_;
+  // One bit for each neighbor in the order that FindEdges returns them.
+  std::vector<u8> neighbor_masks_;
+
+  static constexpr u8 kMineCost = 100;
+
+  // Dynamic costs for the current search. Zero means the tile has no hazard.
+  std::vector<u8> hazard_costs_;
+  std::vector<NodePoint> hazards_;
 };
 
 }  // namespace path
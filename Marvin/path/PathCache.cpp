@@ -0,0 +1,116 @@
+#include "PathCache.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace marvin {
+namespace path {
+
+inline u32 GetCell(NodePoint point) {
+  constexpr u32 kCellsPerRow = 1024 / kPathCacheCellSize;
+
+  return (point.y / kPathCacheCellSize) * kCellsPerRow + (point.x / kPathCacheCellSize);
+}
+
+PathCacheKey::PathCacheKey(NodePoint start, NodePoint goal, float radius, u32 map_version, u32 overlay)
+    : start_cell(GetCell(start)),
+      goal_cell(GetCell(goal)),
+      radius((u16)(radius * 16.0f + 0.5f)),
+      map_version(map_version),
+      overlay(overlay) {}
+
+bool PathCache::Find(const PathCacheKey& key, NodePoint start, NodePoint goal, std::vector<Vector2f>& path) {
+  auto iter = lookup_.find(key);
+
+  if (iter != lookup_.end() && FindSuffix(iter->second, start, goal, path)) {
+    return true;
+  }
+
+  // The start may have moved along a path that was stored under a different start cell.
+  auto candidates = goal_entries_.find(GetGoalKey(key));
+
+  if (candidates != goal_entries_.end()) {
+    for (EntryIterator entry : candidates->second) {
+      if (iter != lookup_.end() && entry == iter->second) continue;
+
+      if (FindSuffix(entry, start, goal, path)) {
+        return true;
+      }
+    }
+  }
+
+  ++misses_;
+  return false;
+}
+
+bool PathCache::FindSuffix(EntryIterator entry, NodePoint start, NodePoint goal, std::vector<Vector2f>& path) {
+  if (!(entry->goal == goal)) return false;
+
+  const std::vector<Vector2f>& cached = entry->path;
+
+  for (std::size_t i = 0; i < cached.size(); ++i) {
+    if ((u16)cached[i].x == start.x && (u16)cached[i].y == start.y) {
+      // Hierarchical paths end with coarse entrance nodes, so a suffix that starts on one would skip the refined
+      // part that a new search would create.
+      if (i + 1 < cached.size() && cached[i].DistanceSq(cached[i + 1]) > 2.0f) return false;
+
+      path.assign(cached.begin() + i, cached.end());
+
+      entries_.splice(entries_.begin(), entries_, entry);
+      ++hits_;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void PathCache::Insert(const PathCacheKey& key, NodePoint goal, const std::vector<Vector2f>& path) {
+  auto iter = lookup_.find(key);
+
+  if (iter != lookup_.end()) {
+    EntryIterator entry = iter->second;
+
+    entry->goal = goal;
+    entry->path = path;
+    entries_.splice(entries_.begin(), entries_, entry);
+    return;
+  }
+
+  entries_.emplace_front(key, goal, path);
+  lookup_[key] = entries_.begin();
+  goal_entries_[GetGoalKey(key)].push_back(entries_.begin());
+
+  Evict();
+}
+
+void PathCache::Clear() {
+  entries_.clear();
+  lookup_.clear();
+  goal_entries_.clear();
+}
+
+void PathCache::SetCapacity(std::size_t capacity) {
+  capacity_ = capacity;
+  Evict();
+}
+
+void PathCache::Evict() {
+  while (entries_.size() > capacity_) {
+    EntryIterator last = std::prev(entries_.end());
+    auto goal_iter = goal_entries_.find(GetGoalKey(last->key));
+    std::vector<EntryIterator>& goal_list = goal_iter->second;
+
+    goal_list.erase(std::find(goal_list.begin(), goal_list.end(), last));
+
+    if (goal_list.empty()) {
+      goal_entries_.erase(goal_iter);
+    }
+
+    lookup_.erase(last->key);
+    entries_.pop_back();
+  }
+}
+
+}  // namespace path
+}  // namespace marvin
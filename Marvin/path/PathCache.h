@@ -0,0 +1,100 @@
+#pragma once
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "../Types.h"
+#include "../Vector2f.h"
+#include "Node.h"
+
+namespace marvin {
+namespace path {
+
+// Paths are stored by the coarse cell of their start and goal tiles.
+constexpr u16 kPathCacheCellSize = 8;
+
+struct PathCacheKey {
+  u32 start_cell;
+  u32 goal_cell;
+  // Ship radius in sixteenths of a tile.
+  u16 radius;
+  // Changes whenever the weights or pathable tiles change.
+  u32 map_version;
+  // Hash of the hazard tiles that the path was searched with.
+  u32 overlay;
+
+  PathCacheKey(NodePoint start, NodePoint goal, float radius, u32 map_version, u32 overlay);
+
+  bool operator==(const PathCacheKey& other) const {
+    return start_cell == other.start_cell && goal_cell == other.goal_cell && radius == other.radius &&
+           map_version == other.map_version && overlay == other.overlay;
+  }
+};
+
+}  // namespace path
+}  // namespace marvin
+
+MAKE_HASHABLE(marvin::path::PathCacheKey, t.start_cell, t.goal_cell, t.radius, t.map_version, t.overlay);
+
+namespace marvin {
+namespace path {
+
+// Least recently used cache of path results.
+// A cached path is reused for any start tile that lies on it by returning the rest of the path from that tile, so a
+// bot that asks for the same goal again while following the path doesn't need a new search.
+class PathCache {
+ public:
+  static constexpr std::size_t kDefaultCapacity = 64;
+
+  PathCache(std::size_t capacity = kDefaultCapacity) : capacity_(capacity) {}
+
+  // Returns true and fills the path if a cached path goes from the start tile to the goal tile.
+  bool Find(const PathCacheKey& key, NodePoint start, NodePoint goal, std::vector<Vector2f>& path);
+  void Insert(const PathCacheKey& key, NodePoint goal, const std::vector<Vector2f>& path);
+
+  // Removes every path but keeps the counters.
+  void Clear();
+  void SetCapacity(std::size_t capacity);
+
+  std::size_t GetCapacity() const { return capacity_; }
+  std::size_t GetSize() const { return entries_.size(); }
+  std::size_t GetHits() const { return hits_; }
+  std::size_t GetMisses() const { return misses_; }
+  void ResetCounters() { hits_ = misses_ = 0; }
+
+ private:
+  struct Entry {
+    PathCacheKey key;
+    NodePoint goal;
+    std::vector<Vector2f> path;
+
+    Entry(const PathCacheKey& key, NodePoint goal, const std::vector<Vector2f>& path)
+        : key(key), goal(goal), path(path) {}
+  };
+
+  typedef std::list<Entry>::iterator EntryIterator;
+
+  bool FindSuffix(EntryIterator entry, NodePoint start, NodePoint goal, std::vector<Vector2f>& path);
+  void Evict();
+
+  // The key without the start cell, which is what the entries that can share a suffix have in common.
+  static PathCacheKey GetGoalKey(const PathCacheKey& key) {
+    PathCacheKey goal_key = key;
+    goal_key.start_cell = 0;
+    return goal_key;
+  }
+
+  std::size_t capacity_;
+  // The most recently used entry is at the front.
+  std::list<Entry> entries_;
+  std::unordered_map<PathCacheKey, EntryIterator> lookup_;
+  // The entries for each goal cell, so a start that moved into another cell only checks the paths to the same goal.
+  std::unordered_map<PathCacheKey, std::vector<EntryIterator>> goal_entries_;
+
+  std::size_t hits_ = 0;
+  std::size_t misses_ = 0;
+};
+
+}  // namespace path
+}  // namespace marvin
@@ -1,13 +1,18 @@
 #include "Pathfinder.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <cmath>
+#include <cstring>
 #include <queue>
-#include <unordered_set>
 
 #include "../Bot.h"
 #include "../Debug.h"
+#include "../MapCache.h"
 #include "../RayCaster.h"
+#include "../TaskGraph.h"
+#include "DistanceField.h"
 
 extern std::unique_ptr<marvin::Bot> bot;
 
@@ -21,8 +26,7 @@ namespace path {
     void Pathfinder::DebugUpdate(const Vector2f& position) {   
         for (float y = -5.00; y <= 5.0f; y++) {
         for (float x = -5.0f; x <= 5.0f; x++) {
-          Node* node = this->processor_->GetNode(NodePoint(uint16_t(position.x + x), uint16_t(position.y + y)));
-          if (node->can_occupy) {
+          if (processor_->CanOccupy(NodePoint(uint16_t(position.x + x), uint16_t(position.y + y)))) {
             Vector2f check(std::floor(position.x) + x, std::floor(position.y) + y);
             RenderWorldLine(position, check, check + Vector2f(1, 1), RGB(255, 100, 100));
             RenderWorldLine(position, check + Vector2f(0, 1), check + Vector2f(1, 0), RGB(255, 100, 100));
@@ -61,29 +65,214 @@ NodePoint ToNodePoint(const Vector2f v, float radius, const Map& map) {
   return np;
 }
 
-inline float Euclidean(NodeProcessor& processor, const Node* from, const Node* to) {
-  NodePoint from_p = processor.GetPoint(from);
-  NodePoint to_p = processor.GetPoint(to);
+// Hierarchical searches refine the path at the tile level until it is this many clusters away from the start.
+constexpr int kRefineClusterDistance = 2;
+
+// Time budgets are only checked after this many expansions since reading the timer isn't free.
+constexpr std::size_t kBudgetCheckInterval = 64;
 
+inline float Euclidean(NodePoint from_p, NodePoint to_p) {
   float dx = static_cast<float>(from_p.x - to_p.x);
   float dy = static_cast<float>(from_p.y - to_p.y);
 
   return sqrt(dx * dx + dy * dy);
 }
 
+inline float Euclidean(NodeProcessor& processor, const Node* from, const Node* to) {
+  return Euclidean(processor.GetPoint(from), processor.GetPoint(to));
+}
+
+// A* search with its own nodes and open set that only reads the tile data from the processor, so a worker on each
+// thread can search at the same time. It searches the same way as ExpandNodes without hazards, so the paths match.
+class SearchWorker {
+ public:
+  SearchWorker(const NodeProcessor& processor) : processor_(processor) {}
+
+  std::vector<Vector2f> Search(NodePoint start_p, NodePoint goal_p) {
+    nodes_.BeginSearch();
+
+    Node* start = GetNode(start_p);
+    Node* goal = GetNode(goal_p);
+
+    openset_.Clear();
+    openset_.Push(start, Euclidean(start_p, goal_p));
+    start->SetFlag(NodeFlag_Openset);
+
+    while (!openset_.Empty()) {
+      Node* node = openset_.Pop();
+
+      if (node == goal) break;
+
+      node->SetFlag(NodeFlag_Closed);
+
+      NodePoint point = GetPoint(node);
+      u8 neighbors = processor_.GetNeighborMask(point);
+
+      for (std::size_t i = 0; i < 8; ++i) {
+        if (!(neighbors & (1 << i))) continue;
+
+        NodePoint edge_p(point.x + kNeighborOffsets[i][0], point.y + kNeighborOffsets[i][1]);
+        Node* edge = GetNode(edge_p);
+        // Only the map weights are read. The hazards are stamped by the game thread while the workers search, and
+        // these paths are cached without an overlay.
+        float cost = node->g + processor_.GetWeight(edge_p) * (i >= 4 ? 1.41421356f : 1.0f);
+
+        if (edge->HasFlag(NodeFlag_Closed) && cost < edge->g) {
+          edge->ClearFlag(NodeFlag_Closed);
+        }
+
+        if (!edge->HasFlag(NodeFlag_Openset) || cost < edge->g) {
+          float f = cost + Euclidean(edge_p, goal_p);
+
+          edge->g = cost;
+          edge->SetParentIndex((u32)nodes_.GetIndex(node));
+          edge->SetFlag(NodeFlag_Openset);
+
+          if (openset_.Contains(edge)) {
+            openset_.Decrease(edge, f);
+          } else {
+            openset_.Push(edge, f);
+          }
+        }
+      }
+    }
+
+    std::vector<Vector2f> path;
+    std::vector<NodePoint> points;
+
+    for (Node* current = goal; current != start;) {
+      u32 index = (u32)nodes_.GetIndex(current);
+      u32 parent_index = current->GetParentIndex();
+
+      if (parent_index == index) break;
+
+      points.push_back(GetPoint(current));
+      current = &nodes_.nodes[parent_index];
+    }
+
+    if (points.empty()) return path;
+
+    path.push_back(Vector2f(start_p.x + 0.5f, start_p.y + 0.5f));
+
+    for (std::size_t i = points.size(); i > 0; --i) {
+      path.push_back(Vector2f(points[i - 1].x + 0.5f, points[i - 1].y + 0.5f));
+    }
+
+    return path;
+  }
+
+ private:
+  Node* GetNode(NodePoint point) { return nodes_.Get(point.y * 1024 + point.x); }
+
+  NodePoint GetPoint(const Node* node) const {
+    std::size_t index = nodes_.GetIndex(node);
+    return NodePoint((u16)(index % 1024), (u16)(index / 1024));
+  }
+
+  const NodeProcessor& processor_;
+  NodeSet nodes_;
+  NodeHeap openset_;
+};
+
 Pathfinder::Pathfinder(std::unique_ptr<NodeProcessor> processor, RegionRegistry& regions)
-    : processor_(std::move(processor)), regions_(regions) {}
+    : processor_(std::move(processor)), regions_(regions) {
+  planner_ = std::make_unique<IncrementalPlanner>(*processor_);
+}
+
+Pathfinder::~Pathfinder() {
+  std::unique_lock<std::mutex> lock(cluster_mutex_);
+
+  cluster_done_.wait(lock, [this]() { return !cluster_build_running_; });
+}
 
 std::vector<Vector2f> Pathfinder::FindPath(const Map& map, const std::vector<Vector2f>& mines, const Vector2f& from,
-                                           const Vector2f& to, float radius) {
+                                           const Vector2f& to, float radius, SearchMode mode) {
+  // The incremental planner and the flow fields keep their own state, so their results aren't cached.
+  if (mode == SearchMode::Incremental || mode == SearchMode::FlowField) {
+    return SearchPath(map, mines, from, to, radius, mode);
+  }
+
+  NodePoint start = ToNodePoint(from, radius, map);
+  NodePoint goal = ToNodePoint(to, radius, map);
+
+  PathCacheKey key = GetCacheKey(start, goal, radius, mines);
   std::vector<Vector2f> path;
 
-  // Clear the touched nodes before pathfinding.
-  for (Node* node : touched_nodes_) {
-    // Setting the flag to zero causes GetNode to reset the node on next fetch.
-    node->flags = 0;
+  if (cache_.Find(key, start, goal, path)) {
+    stats_ = SearchStats();
+    stats_.mode = mode;
+    stats_.cache_hit = true;
+    return path;
+  }
+
+  path = SearchPath(map, mines, from, to, radius, mode);
+
+  if (!path.empty()) {
+    cache_.Insert(key, goal, path);
+  }
+
+  return path;
+}
+
+std::vector<std::vector<Vector2f>> Pathfinder::FindPaths(const Map& map, const std::vector<Vector2f>& from,
+                                                         const std::vector<Vector2f>& to, float radius,
+                                                         WorkerPool& workers) {
+  std::size_t count = std::min(from.size(), to.size());
+  std::vector<std::vector<Vector2f>> paths(count);
+  std::vector<NodePoint> starts(count);
+  std::vector<NodePoint> goals(count);
+  std::vector<std::size_t> searches;
+
+  for (std::size_t i = 0; i < count; ++i) {
+    starts[i] = ToNodePoint(from[i], radius, map);
+    goals[i] = ToNodePoint(to[i], radius, map);
+
+    if (starts[i].x >= 1024 || starts[i].y >= 1024 || goals[i].x >= 1024 || goals[i].y >= 1024) continue;
+    if (!regions_.IsConnected(MapCoord(starts[i].x, starts[i].y), MapCoord(goals[i].x, goals[i].y))) continue;
+
+    if (!cache_.Find(GetCacheKey(starts[i], goals[i], radius, {}), starts[i], goals[i], paths[i])) {
+      searches.push_back(i);
+    }
   }
-  touched_nodes_.clear();
+
+  std::size_t worker_count = std::min(workers.GetThreadCount(), searches.size());
+  std::atomic<std::size_t> next_search(0);
+  TaskGraph graph;
+
+  // Each worker takes the next search until they're all done. The workers are only kept for the batch since each
+  // one has a full set of nodes.
+  for (std::size_t i = 0; i < worker_count; ++i) {
+    graph.Add("search", [&]() {
+      SearchWorker worker(*processor_);
+
+      for (std::size_t next = next_search++; next < searches.size(); next = next_search++) {
+        std::size_t index = searches[next];
+
+        paths[index] = worker.Search(starts[index], goals[index]);
+      }
+    });
+  }
+
+  graph.Run(workers);
+
+  for (std::size_t index : searches) {
+    if (!paths[index].empty()) {
+      cache_.Insert(GetCacheKey(starts[index], goals[index], radius, {}), goals[index], paths[index]);
+    }
+  }
+
+  return paths;
+}
+
+std::vector<Vector2f> Pathfinder::SearchPath(const Map& map, const std::vector<Vector2f>& mines, const Vector2f& from,
+                                             const Vector2f& to, float radius, SearchMode mode) {
+  std::vector<Vector2f> path;
+
+  stats_ = SearchStats();
+  stats_.mode = mode;
+
+  // Starting a new generation causes GetNode to reset each node on its first fetch in this search.
+  processor_->BeginSearch();
 
   Node* start = processor_->GetNode(ToNodePoint(from, radius, map));
   Node* goal = processor_->GetNode(ToNodePoint(to, radius, map));
@@ -99,56 +288,143 @@ std::vector<Vector2f> Pathfinder::FindPath(const Map& map, const std::vector<Vec
     return path;
   }
 
-  // clear vector then add start node
+  if (mode == SearchMode::Hierarchical) {
+    return FindHierarchicalPath(map, mines, from, to, radius, start_p, goal_p);
+  }
+
+  processor_->SetHazards(mines);
+
+  if (mode == SearchMode::Incremental) {
+    std::vector<NodePoint> points;
+    bool planned = planner_->Plan(start_p, goal_p, points);
+
+    if (planned) {
+      processor_->ClearHazards();
+      stats_.nodes_expanded = planner_->GetNodesExpanded();
+
+      for (NodePoint point : points) {
+        path.push_back(Vector2f(point.x + 0.5f, point.y + 0.5f));
+      }
+
+      return path;
+    }
+  }
+
+  if (mode == SearchMode::FlowField) {
+    // The hazards are stamped, so the field is built with them and rebuilt when they change.
+    const FlowField* field = flow_fields_.Get(*processor_, goal_p, map_version_, GetOverlayHash(mines), workers_);
+
+    if (field) {
+      processor_->ClearHazards();
+      return field->GetPath(start_p);
+    }
+
+    // The field is still being built, so this search runs on the tiles.
+    mode = SearchMode::AStar;
+    stats_.mode = mode;
+  }
+
   openset_.Clear();
-  openset_.Push(start);
+  PushStart(openset_, start, goal);
+  ExpandNodes(openset_, start, goal, mode, SearchBudget());
+
+  processor_->ClearHazards();
 
-  touched_nodes_.insert(start);
-  touched_nodes_.insert(goal);
+  return BuildPath(start, goal);
+}
+
+void Pathfinder::PushStart(NodeHeap& openset, Node* start, Node* goal) {
+  openset.Push(start, Euclidean(*processor_, start, goal));
+  start->SetFlag(NodeFlag_Openset);
+  ++stats_.heap_pushes;
+}
+
+bool Pathfinder::ExpandNodes(NodeHeap& openset, Node* start, Node* goal, SearchMode mode,
+                             const SearchBudget& budget) {
+  PerformanceTimer timer;
+  u64 elapsed = 0;
+  std::size_t expanded = 0;
 
   // at the start there is only one node here, the start node
-  while (!openset_.Empty()) {
-    // grab front item then delete it
-    Node* node = openset_.Pop();
+  while (!openset.Empty()) {
+    // The budget is checked before popping so the next node stays in the open set for the next call.
+    if (budget.nodes > 0 && expanded >= budget.nodes) return false;
+
+    if (budget.microseconds > 0 && expanded > 0 && expanded % kBudgetCheckInterval == 0) {
+      elapsed += timer.GetElapsedTime();
 
-    touched_nodes_.insert(node);
+      if (elapsed >= budget.microseconds) return false;
+    }
+
+    // grab front item then delete it
+    Node* node = openset.Pop();
+    ++stats_.heap_pops;
 
     // this is the only way to break the pathfinder
     if (node == goal) {
-      break;
+      return true;
     }
 
-    node->flags |= NodeFlag_Closed;
+    node->SetFlag(NodeFlag_Closed);
+    ++stats_.nodes_expanded;
+    ++expanded;
+
+    // Partial results lead to the expanded node that is closest to the goal.
+    if (!budget.IsUnlimited()) {
+      float distance = Euclidean(*processor_, node, goal);
+
+      if (sliced_.closest == nullptr || distance < sliced_.closest_distance) {
+        sliced_.closest = node;
+        sliced_.closest_distance = distance;
+      }
+    }
 
     // returns neighbor nodes that are not solid
-    NodeConnections connections = processor_->FindEdges(mines, node, start, goal);
+    NodeConnections connections;
+
+    if (mode == SearchMode::JumpPoint) {
+      connections = processor_->FindJumpEdges(node, goal);
+    } else {
+      connections = processor_->FindEdges(node);
+    }
 
     for (std::size_t i = 0; i < connections.count; ++i) {
       Node* edge = connections.neighbors[i];
 
-      touched_nodes_.insert(edge);
+      float cost = node->g + connections.costs[i];
 
-      float cost = node->g + edge->weight * Euclidean(*processor_, node, edge);
-
-      if ((edge->flags & NodeFlag_Closed) && cost < edge->g) {
-        edge->flags &= ~NodeFlag_Closed;
+      if (edge->HasFlag(NodeFlag_Closed) && cost < edge->g) {
+        edge->ClearFlag(NodeFlag_Closed);
       }
 
-      float h = Euclidean(*processor_, edge, goal);
+      if (!edge->HasFlag(NodeFlag_Openset) || cost < edge->g) {
+        float f = cost + Euclidean(*processor_, edge, goal);
 
-      if (!(edge->flags & NodeFlag_Openset) || cost + h < edge->f) {
         edge->g = cost;
-        edge->f = edge->g + h;
-        edge->parent = node;
+        processor_->SetParent(edge, node);
 
-        edge->flags |= NodeFlag_Openset;
+        edge->SetFlag(NodeFlag_Openset);
 
-        openset_.Push(edge);
+        // Nodes that are still in the open set are moved in place instead of being pushed again.
+        if (openset.Contains(edge)) {
+          openset.Decrease(edge, f);
+          ++stats_.heap_updates;
+        } else {
+          openset.Push(edge, f);
+          ++stats_.heap_pushes;
+        }
       }
     }
   }
 
-  if (goal->parent) {
+  return true;
+}
+
+std::vector<Vector2f> Pathfinder::BuildPath(Node* start, Node* goal) {
+  std::vector<Vector2f> path;
+  NodePoint start_p = processor_->GetPoint(start);
+
+  if (processor_->GetParent(goal)) {
     path.push_back(Vector2f(start_p.x + 0.5f, start_p.y + 0.5f));
   }
 
@@ -159,7 +435,27 @@ std::vector<Vector2f> Pathfinder::FindPath(const Map& map, const std::vector<Vec
   while (current != nullptr && current != start) {
     NodePoint p = processor_->GetPoint(current);
     points.push_back(p);
-    current = current->parent;
+
+    Node* parent = processor_->GetParent(current);
+
+    if (parent == nullptr) break;
+
+    // Jump point search links nodes that aren't neighbors, so fill in the tiles between them to keep the path
+    // one tile per node. The jumps are always straight or diagonal lines.
+    NodePoint parent_p = processor_->GetPoint(parent);
+    int dx = (parent_p.x > p.x) - (parent_p.x < p.x);
+    int dy = (parent_p.y > p.y) - (parent_p.y < p.y);
+
+    p.x += dx;
+    p.y += dy;
+
+    while (!(p == parent_p)) {
+      points.push_back(p);
+      p.x += dx;
+      p.y += dy;
+    }
+
+    current = parent;
   }
 
   // Reverse and store as vector
@@ -173,32 +469,325 @@ std::vector<Vector2f> Pathfinder::FindPath(const Map& map, const std::vector<Vec
   return path;
 }
 
-std::vector<Vector2f> Pathfinder::SmoothPath(Bot& bot, const std::vector<Vector2f>& path, float ship_radius) {
-  std::vector<Vector2f> result = path;
-  return result;
+std::vector<Vector2f> Pathfinder::FindHierarchicalPath(const Map& map, const std::vector<Vector2f>& mines,
+                                                       const Vector2f& from, const Vector2f& to, float radius,
+                                                       NodePoint start, NodePoint goal) {
+  NodePoint refine_point;
+  std::vector<Vector2f> coarse_path;
+
+  if (!FindRefinePoint(start, goal, &refine_point, coarse_path)) {
+    std::vector<Vector2f> path = SearchPath(map, mines, from, to, radius, SearchMode::AStar);
+    stats_.mode = SearchMode::Hierarchical;
+    return path;
+  }
+
+  std::size_t abstract_expanded = clusters_->GetNodesExpanded();
+  Vector2f refine_to(refine_point.x + 0.5f, refine_point.y + 0.5f);
+
+  std::vector<Vector2f> path = SearchPath(map, mines, from, refine_to, radius, SearchMode::AStar);
+
+  stats_.mode = SearchMode::Hierarchical;
+  stats_.nodes_expanded += abstract_expanded;
+
+  if (path.empty()) return path;
+
+  path.insert(path.end(), coarse_path.begin(), coarse_path.end());
+
+  return path;
+}
+
+bool Pathfinder::FindRefinePoint(NodePoint start, NodePoint goal, NodePoint* refine_point,
+                                 std::vector<Vector2f>& coarse_path) {
+  auto get_cluster_distance = [](NodePoint first, NodePoint second) {
+    int dx = std::abs(first.x / kClusterSize - second.x / kClusterSize);
+    int dy = std::abs(first.y / kClusterSize - second.y / kClusterSize);
+
+    return std::max(dx, dy);
+  };
+
+  std::vector<NodePoint> entrances;
+
+  // Short searches are cheap enough to run on the tiles directly. Clusters that were built for another ship's radius
+  // can lead through gaps that the ship doesn't fit in, so they aren't used until they're built again.
+  if (clusters_ && cluster_radius_ == pathable_radius_ && get_cluster_distance(start, goal) > kRefineClusterDistance) {
+    entrances = clusters_->FindPath(start, goal);
+  }
+
+  if (entrances.empty()) return false;
+
+  // Only refine the path to the first entrance that is a few clusters away. The rest of the entrances are used as
+  // coarse nodes and the path gets rebuilt once the bot loses sight of the next one.
+  std::size_t refine_index = 1;
+
+  while (refine_index < entrances.size() - 1 &&
+         get_cluster_distance(start, entrances[refine_index]) < kRefineClusterDistance) {
+    ++refine_index;
+  }
 
+  *refine_point = entrances[refine_index];
 
- for (std::size_t i = 0; i < result.size(); i++) {
-    std::size_t next = i + 1;
+  for (std::size_t i = refine_index + 1; i < entrances.size(); ++i) {
+    coarse_path.push_back(Vector2f(entrances[i].x + 0.5f, entrances[i].y + 0.5f));
+  }
+
+  return true;
+}
+
+SearchStatus Pathfinder::StartSlicedSearch(const Map& map, const std::vector<Vector2f>& mines, const Vector2f& from,
+                                           const Vector2f& to, float radius, SearchMode mode,
+                                           const SearchBudget& budget, std::vector<Vector2f>& path) {
+  sliced_ = SlicedSearch();
+  sliced_.map = &map;
+  sliced_.mines = mines;
+  sliced_.from = from;
+  sliced_.to = to;
+  sliced_.radius = radius;
+  sliced_.mode = mode;
+
+  path.clear();
+
+  // The incremental planner and the flow fields already keep their work between frames.
+  if (mode == SearchMode::Incremental || mode == SearchMode::FlowField) {
+    path = FindPath(map, mines, from, to, radius, mode);
+    return path.empty() ? SearchStatus::Failed : SearchStatus::Complete;
+  }
+
+  NodePoint start = ToNodePoint(from, radius, map);
+  NodePoint goal = ToNodePoint(to, radius, map);
+
+  if (cache_.Find(GetCacheKey(start, goal, radius, mines), start, goal, path)) {
+    stats_ = SearchStats();
+    stats_.mode = mode;
+    stats_.cache_hit = true;
+    return SearchStatus::Complete;
+  }
+
+  sliced_.active = true;
+  sliced_.interrupted = true;
+
+  if (!sliced_nodes_) {
+    sliced_nodes_ = std::make_unique<NodeSet>();
+  }
+
+  return ContinueSlicedSearch(budget, path);
+}
+
+SearchStatus Pathfinder::ContinueSlicedSearch(const SearchBudget& budget, std::vector<Vector2f>& path) {
+  path.clear();
+
+  if (!sliced_.active) return SearchStatus::Failed;
 
-    if (next == result.size() - 1) {
-      return result;
+  stats_ = sliced_.stats;
+  processor_->SetNodeSet(sliced_nodes_.get());
+
+  SearchStatus status = ExpandSlicedSearch(budget, path);
+
+  processor_->SetNodeSet(nullptr);
+  sliced_.stats = stats_;
+
+  return status;
+}
+
+SearchStatus Pathfinder::ExpandSlicedSearch(const SearchBudget& budget, std::vector<Vector2f>& path) {
+  const Map& map = *sliced_.map;
+
+  // The search was just started or the map data changed since the last call, so it needs to start over.
+  if (sliced_.interrupted) {
+    stats_ = SearchStats();
+    stats_.mode = sliced_.mode;
+
+    processor_->BeginSearch();
+
+    sliced_.interrupted = false;
+    sliced_.closest = nullptr;
+    sliced_.coarse_path.clear();
+    sliced_.start = ToNodePoint(sliced_.from, sliced_.radius, map);
+    sliced_.goal = ToNodePoint(sliced_.to, sliced_.radius, map);
+
+    if (!regions_.IsConnected(MapCoord(sliced_.start.x, sliced_.start.y),
+                              MapCoord(sliced_.goal.x, sliced_.goal.y))) {
+      sliced_.active = false;
+      return SearchStatus::Failed;
     }
 
-    bool hit = DiameterRayCastHit(bot, result[i], result[next], 3.0f);
+    if (sliced_.mode == SearchMode::Hierarchical) {
+      NodePoint refine_point;
 
-    if (!hit) {
-      result.erase(result.begin() + next);
-      i--;
+      if (FindRefinePoint(sliced_.start, sliced_.goal, &refine_point, sliced_.coarse_path)) {
+        stats_.nodes_expanded += clusters_->GetNodesExpanded();
+        sliced_.goal = refine_point;
+      }
     }
- }
 
-  return result;
+    sliced_openset_.Clear();
+    PushStart(sliced_openset_, processor_->GetNode(sliced_.start), processor_->GetNode(sliced_.goal));
+  }
+
+  Node* start = processor_->GetNode(sliced_.start);
+  Node* goal = processor_->GetNode(sliced_.goal);
+  SearchMode tile_mode = sliced_.mode == SearchMode::JumpPoint ? SearchMode::JumpPoint : SearchMode::AStar;
+
+  processor_->SetHazards(sliced_.mines);
+  bool finished = ExpandNodes(sliced_openset_, start, goal, tile_mode, budget);
+  processor_->ClearHazards();
+
+  if (!finished) {
+    if (sliced_.closest) {
+      path = BuildPath(start, sliced_.closest);
+    }
+
+    return SearchStatus::InProgress;
+  }
+
+  sliced_.active = false;
+  path = BuildPath(start, goal);
+
+  if (path.empty()) return SearchStatus::Failed;
+
+  path.insert(path.end(), sliced_.coarse_path.begin(), sliced_.coarse_path.end());
+
+  NodePoint cache_goal = ToNodePoint(sliced_.to, sliced_.radius, map);
+
+  cache_.Insert(GetCacheKey(sliced_.start, cache_goal, sliced_.radius, sliced_.mines), cache_goal, path);
+
+  return SearchStatus::Complete;
+}
+
+PathCacheKey Pathfinder::GetCacheKey(NodePoint start, NodePoint goal, float radius, const std::vector<Vector2f>& mines) {
+  return PathCacheKey(start, goal, radius, map_version_, GetOverlayHash(mines));
 }
 
+u32 Pathfinder::GetOverlayHash(const std::vector<Vector2f>& mines) {
+  std::size_t overlay = 0;
 
+  for (const Vector2f& mine : mines) {
+    hash_combine(overlay, (u16)mine.x, (u16)mine.y);
+  }
+
+  return (u32)overlay;
+}
 
-std::vector<Vector2f> Pathfinder::CreatePath(Bot& bot, Vector2f from, Vector2f to, float radius) {
+// Calls the visitor on every tile that the line touches, including both tiles when it passes exactly through a
+// corner. Stops and returns false as soon as the visitor does.
+template <typename Visitor>
+static bool WalkLine(const Vector2f& from, const Vector2f& to, Visitor visit) {
+  int x = (int)std::floor(from.x);
+  int y = (int)std::floor(from.y);
+  int end_x = (int)std::floor(to.x);
+  int end_y = (int)std::floor(to.y);
+
+  Vector2f delta = to - from;
+  int step_x = delta.x > 0.0f ? 1 : -1;
+  int step_y = delta.y > 0.0f ? 1 : -1;
+
+  // Distance along the line, as a fraction of its length, to cross a whole tile and to reach the next tile border.
+  float delta_x = delta.x != 0.0f ? std::abs(1.0f / delta.x) : std::numeric_limits<float>::max();
+  float delta_y = delta.y != 0.0f ? std::abs(1.0f / delta.y) : std::numeric_limits<float>::max();
+  float next_x = delta.x > 0.0f ? (x + 1 - from.x) * delta_x : (from.x - x) * delta_x;
+  float next_y = delta.y > 0.0f ? (y + 1 - from.y) * delta_y : (from.y - y) * delta_y;
+
+  if (delta.x == 0.0f) next_x = std::numeric_limits<float>::max();
+  if (delta.y == 0.0f) next_y = std::numeric_limits<float>::max();
+
+  if (!visit((u16)x, (u16)y)) return false;
+
+  while (x != end_x || y != end_y) {
+    // Floating point error can't move the walk past the end tile on either axis.
+    bool move_x = y == end_y || (x != end_x && next_x < next_y);
+    bool move_y = x == end_x || (y != end_y && next_y < next_x);
+
+    if (!move_x && !move_y) {
+      // The line goes through the corner, so the ship touches both tiles beside it.
+      if (!visit((u16)(x + step_x), (u16)y) || !visit((u16)x, (u16)(y + step_y))) return false;
+
+      move_x = move_y = true;
+    }
+
+    if (move_x) {
+      x += step_x;
+      next_x += delta_x;
+    }
+
+    if (move_y) {
+      y += step_y;
+      next_y += delta_y;
+    }
+
+    if (!visit((u16)x, (u16)y)) return false;
+  }
+
+  return true;
+}
+
+std::vector<Vector2f> Pathfinder::SmoothPath(Bot& bot, const std::vector<Vector2f>& path, float ship_radius) {
+  if (path.size() <= 2) return path;
+
+  const Map& map = bot.GetGame().GetMap();
+  std::vector<Vector2f> result;
+
+  // A shortcut is taken only when the ship fits on every tile along it and none of those tiles cost more than the
+  // most expensive tile on the part of the path that it replaces. This keeps the path away from walls where the
+  // weights pushed it away, but straightens it everywhere else.
+  auto get_max_cost = [this](const Vector2f& from, const Vector2f& to) {
+    float max_cost = 0.0f;
+
+    WalkLine(from, to, [this, &max_cost](u16 x, u16 y) {
+      if (x < 1024 && y < 1024) {
+        max_cost = std::max(max_cost, processor_->GetCost(NodePoint(x, y)));
+      }
+      return true;
+    });
+
+    return max_cost;
+  };
+
+  auto is_clear = [this, &map, ship_radius](const Vector2f& from, const Vector2f& to, float max_cost) {
+    return WalkLine(from, to, [this, &map, ship_radius, max_cost](u16 x, u16 y) {
+      if (x >= 1024 || y >= 1024) return false;
+
+      return map.CanPathOn(Vector2f(x, y), ship_radius) && processor_->GetCost(NodePoint(x, y)) <= max_cost;
+    });
+  };
+
+  // The highest cost on each segment of the original path.
+  std::vector<float> segment_costs(path.size(), 0.0f);
+
+  for (std::size_t i = 1; i < path.size(); ++i) {
+    segment_costs[i] = get_max_cost(path[i - 1], path[i]);
+  }
+
+  // String pulling in a single pass. The anchor is the last corner that was kept, and the path is followed while the
+  // anchor can still see the next point. The first point it can't see makes the last visible point the next corner.
+  std::size_t anchor = 0;
+  std::size_t last_visible = 1;
+  // The highest segment cost between the anchor and the last visible point.
+  float replaced_cost = segment_costs[1];
+
+  result.push_back(path[0]);
+
+  for (std::size_t next = 2; next < path.size(); ++next) {
+    float cost = std::max(replaced_cost, segment_costs[next]);
+
+    if (is_clear(path[anchor], path[next], cost)) {
+      last_visible = next;
+      replaced_cost = cost;
+      continue;
+    }
+
+    result.push_back(path[last_visible]);
+
+    // The blocked point follows the new anchor on the path, so it can always be reached from it.
+    anchor = last_visible;
+    last_visible = next;
+    replaced_cost = segment_costs[next];
+  }
+
+  result.push_back(path[last_visible]);
+
+  return result;
+}
+
+std::vector<Vector2f> Pathfinder::CreatePath(Bot& bot, Vector2f from, Vector2f to, float radius, SearchMode mode) {
   bool build = true;
 
   if (!path_.empty()) {
@@ -222,7 +811,6 @@ std::vector<Vector2f> Pathfinder::CreatePath(Bot& bot, Vector2f from, Vector2f t
 
   if (build) {
     std::vector<Vector2f> mines;
-    path_.clear();
     //#if 0
     for (Weapon* weapon : processor_->GetGame().GetWeapons()) {
       const Player* weapon_player = processor_->GetGame().GetPlayerById(weapon->GetPlayerId());
@@ -231,7 +819,56 @@ std::vector<Vector2f> Pathfinder::CreatePath(Bot& bot, Vector2f from, Vector2f t
       if (weapon->IsMine()) mines.push_back(weapon->GetPosition());
     }
     //#endif
-    path_ = FindPath(processor_->GetGame().GetMap(), mines, from, to, radius);
+    const Map& map = processor_->GetGame().GetMap();
+
+    // Flow fields are built on the workers, so the path is searched on the tiles like any other until it's ready.
+    // The field needs to be built with the current mines, so a new set of mines also goes back to the tiles.
+    if (mode == SearchMode::FlowField) {
+      processor_->SetHazards(mines);
+
+      if (!flow_fields_.Get(*processor_, ToNodePoint(to, radius, map), map_version_, GetOverlayHash(mines), workers_)) {
+        mode = SearchMode::AStar;
+      }
+
+      processor_->ClearHazards();
+    }
+
+    // The old path was already smoothed when it was created, so it's only smoothed again when it's replaced.
+    bool replaced = true;
+
+    if (search_budget_.IsUnlimited() || mode == SearchMode::Incremental || mode == SearchMode::FlowField) {
+      path_ = FindPath(map, mines, from, to, radius, mode);
+      partial_path_ = false;
+    } else {
+      std::vector<Vector2f> path;
+      SearchStatus status;
+
+      // Keep working on the search that is already going to this destination.
+      if (sliced_.active && sliced_.mode == mode && sliced_.to.DistanceSq(to) < 3 * 3) {
+        status = ContinueSlicedSearch(search_budget_, path);
+      } else {
+        status = StartSlicedSearch(map, mines, from, to, radius, mode, search_budget_, path);
+      }
+
+      // The old path is followed until the new one finishes. The partial path is only used when there's nothing
+      // else to follow.
+      if (status != SearchStatus::InProgress) {
+        path_ = path;
+        partial_path_ = false;
+      } else if (path_.empty() || partial_path_) {
+        path_ = path;
+        partial_path_ = true;
+      } else {
+        replaced = false;
+      }
+    }
+
+    // The smoothing uses the mine costs so shortcuts don't cut through the tiles the search went around.
+    if (replaced) {
+      processor_->SetHazards(mines);
+      path_ = SmoothPath(bot, path_, radius);
+      processor_->ClearHazards();
+    }
   }
 
   return path_;
@@ -258,61 +895,304 @@ float Pathfinder::GetWallDistance(const Map& map, u16 x, u16 y, u16 radius) {
 }
 
 void Pathfinder::CreateMapWeights(const Map& map) {
+  // The bot creates the weights from a job on its worker pool next to the other load tasks, so the field can't split
+  // into jobs on the same pool and runs on this thread.
+  std::vector<float> wall_distances = CreateWallDistanceField(map);
 
   for (u16 y = 0; y < 1024; ++y) {
     for (u16 x = 0; x < 1024; ++x) {
       if (map.IsSolid(x, y)) continue;
 
-      Node* node = this->processor_->GetNode(NodePoint(x, y));
+      SetMapWeight(map, x, y, std::sqrt(wall_distances[(size_t)y * 1024 + x]));
+    }
+  }
 
-      // Search width is double this number (for 8, searches a 16 x 16 square).
-      int close_distance = 8;
+  processor_->UpdateJumpMasks();
+  planner_->Reset();
+  flow_fields_.Clear();
+  ++map_version_;
+  sliced_.interrupted = true;
+}
 
-      /* Causes exponentianl weight increase as the path gets closer to wall tiles.  
-      Known Issue: 3 tile gaps and 4 tile gaps will carry the same weight since each tiles closest wall is 2 tiles away.*/
+void Pathfinder::SetMapWeight(const Map& map, u16 x, u16 y, float distance) {
+  // Safe tiles are avoided unless there's no other way around.
+  if (map.GetTileId(x, y) == kSafeTileId) {
+    processor_->SetWeight(NodePoint(x, y), 10.0f);
+    return;
+  }
 
-      float distance = GetWallDistance(map, x, y, close_distance);
+  int close_distance = 8;
 
-      // Nodes are initialized with a weight of 1.0f, so never calculate when the distance is greater or equal
-      // because the result will be less than 1.0f.
-      if (distance < close_distance) {
-        float weight = 8.0f / distance;
-        //paths directly next to a wall will be a last resort, 1 tile from wall very unlikely
-        node->weight = (float)std::pow(weight, 4.0);
-        node->previous_weight = node->weight;
-      }
-    }
+  /* Causes exponentianl weight increase as the path gets closer to wall tiles.  
+  Known Issue: 3 tile gaps and 4 tile gaps will carry the same weight since each tiles closest wall is 2 tiles away.*/
+
+  // Nodes are initialized with a weight of 1.0f, so never calculate when the distance is greater or equal
+  // because the result will be less than 1.0f.
+  if (distance < close_distance) {
+    float weight = 8.0f / distance;
+    //paths directly next to a wall will be a last resort, 1 tile from wall very unlikely
+    processor_->SetWeight(NodePoint(x, y), (float)std::pow(weight, 4.0));
   }
 }
 
 void Pathfinder::SetPathableNodes(const Map& map, float radius) {
   for (u16 y = 0; y < 1024; ++y) {
     for (u16 x = 0; x < 1024; ++x) {
+      // The flags are replaced so the tiles that only fit the previous ship's radius stop being pathable.
+      TileFlags flags = 0;
 
-      if (map.IsSolid(x, y)) continue;
+      if (!map.IsSolid(x, y)) {
+        if (map.CanPathOn(Vector2f(x, y), radius)) {
+          flags |= TileFlag_Pathable;
+        }
+        if (map.CanOccupy(Vector2f(x, y), radius)) {
+          flags |= TileFlag_Occupiable;
+        }
+      }
 
-      Node* node = this->processor_->GetNode(NodePoint(x, y));
+      processor_->SetTileFlags(NodePoint(x, y), flags);
+    }
+  }
 
-      if (map.CanPathOn(Vector2f(x, y), radius)) {
-        node->is_pathable = true;
-      }
-      if (map.CanOccupy(Vector2f(x, y), radius)) {
-        node->can_occupy = true;
+  pathable_radius_ = radius;
+
+  processor_->UpdateNeighborMasks();
+  processor_->UpdateJumpMasks();
+  planner_->Reset();
+  flow_fields_.Clear();
+  ++map_version_;
+  sliced_.interrupted = true;
+}
+
+void Pathfinder::UpdateTiles(const Map& map, const std::vector<MapCoord>& tiles, float radius) {
+  if (tiles.empty()) return;
+
+  int tile_diameter = (int)((radius + 0.5f) * 2);
+  // The weights use walls up to 8 tiles away and the pathable flags use the tiles that the ship covers.
+  int reach = std::max(8, tile_diameter);
+
+  for (const MapCoord& tile : tiles) {
+    int min_x = std::max(tile.x - reach, 0);
+    int min_y = std::max(tile.y - reach, 0);
+    int max_x = std::min(tile.x + reach, 1023);
+    int max_y = std::min(tile.y + reach, 1023);
+
+    for (int tile_y = min_y; tile_y <= max_y; ++tile_y) {
+      for (int tile_x = min_x; tile_x <= max_x; ++tile_x) {
+        NodePoint point((u16)tile_x, (u16)tile_y);
+
+        processor_->ResetWeight(point);
+        processor_->SetTileFlags(point, 0);
+
+        if (map.IsSolid(point.x, point.y)) continue;
+
+        SetMapWeight(map, point.x, point.y, GetWallDistance(map, point.x, point.y, 8));
+
+        if (map.CanPathOn(Vector2f(point.x, point.y), radius)) {
+          processor_->SetTileFlag(point, TileFlag_Pathable);
+        }
+        if (map.CanOccupy(Vector2f(point.x, point.y), radius)) {
+          processor_->SetTileFlag(point, TileFlag_Occupiable);
+        }
       }
     }
+
+    // The masks of the tiles around the area include the pathable flags inside of it.
+    processor_->UpdateNeighborMasks(min_x - 1, min_y - 1, max_x + 1, max_y + 1);
+    processor_->UpdateJumpMasks(min_x, min_y, max_x, max_y);
+    planner_->UpdateTiles(min_x - 1, min_y - 1, max_x + 1, max_y + 1);
+
+    if (clusters_) {
+      clusters_->Update(min_x, min_y, max_x, max_y);
+    }
+  }
+
+  flow_fields_.Clear();
+  ++map_version_;
+  sliced_.interrupted = true;
+
+  // The running build copied the tiles before this change, so another one is started once it finishes.
+  if (building_clusters_) {
+    clusters_stale_ = true;
+  }
+}
+
+void Pathfinder::SaveMapData(CacheWriter& writer) const {
+  processor_->SaveTileData(writer);
+
+  writer.Write(pathable_radius_);
+  writer.Write((u8)(clusters_ != nullptr));
+
+  if (clusters_) {
+    writer.Write(cluster_radius_);
+    clusters_->Save(writer);
   }
 }
 
+bool Pathfinder::LoadMapData(const Map& map, CacheReader& reader) {
+  u8 has_clusters = 0;
+
+  if (!processor_->LoadTileData(reader) || !reader.Read(pathable_radius_) || !reader.Read(has_clusters)) {
+    return false;
+  }
+
+  if (has_clusters) {
+    if (!clusters_) {
+      clusters_ = std::make_unique<ClusterGraph>(*processor_, map);
+    }
+
+    if (!reader.Read(cluster_radius_) || !clusters_->Load(reader)) return false;
+  }
+
+  processor_->UpdateNeighborMasks();
+  processor_->UpdateJumpMasks();
+  planner_->Reset();
+  flow_fields_.Clear();
+  ++map_version_;
+  sliced_.interrupted = true;
+  return true;
+}
+
+void Pathfinder::CreateClusters(const Map& map) {
+  if (!clusters_) {
+    clusters_ = std::make_unique<ClusterGraph>(*processor_, map);
+  }
+
+  clusters_->Build();
+  cluster_radius_ = pathable_radius_;
+}
+
+void Pathfinder::StartClusterBuild(const Map& map) {
+  cluster_build_map_ = &map;
+  cluster_build_radius_ = pathable_radius_;
+
+  if (building_clusters_) {
+    // The running build copied the tiles for the old radius, so another one is started once it finishes.
+    clusters_stale_ = true;
+    return;
+  }
+
+  auto tiles = std::make_shared<ClusterTiles>(map, *processor_);
+
+  auto build = [this, &map, tiles]() {
+    auto clusters = std::make_unique<ClusterGraph>(*processor_, map);
+
+    clusters->Build(*tiles);
+
+    std::lock_guard<std::mutex> lock(cluster_mutex_);
+
+    built_clusters_ = std::move(clusters);
+    cluster_build_running_ = false;
+    cluster_done_.notify_all();
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(cluster_mutex_);
+    cluster_build_running_ = true;
+  }
+
+  building_clusters_ = true;
+
+  if (workers_ == nullptr) {
+    build();
+    CollectClusters();
+    return;
+  }
+
+  workers_->Submit(build);
+}
+
+void Pathfinder::CollectClusters() {
+  if (!building_clusters_) return;
+
+  std::unique_ptr<ClusterGraph> clusters;
+
+  {
+    std::lock_guard<std::mutex> lock(cluster_mutex_);
+
+    if (cluster_build_running_) return;
+
+    clusters = std::move(built_clusters_);
+  }
+
+  building_clusters_ = false;
+
+  if (clusters_stale_) {
+    clusters_stale_ = false;
+    StartClusterBuild(*cluster_build_map_);
+    return;
+  }
+
+  clusters_ = std::move(clusters);
+  cluster_radius_ = cluster_build_radius_;
+}
+
   // Use breadth first search to find the nearest node index.
  // use region registry to search through solid tiles that are not connected to the regions barrier
  // to get a more accurate result
 size_t PathNodeSearch::FindNearestNodeBFS(const Vector2f& start) {
 
   // this may happen when targets die
-  if (path.empty() || !IsValidPosition(start)) {
+  if (path == nullptr || path->empty() || !IsValidPosition(start)) {
     return 0;
   }
 
+  if (corridor_range > 0 && corridor_range >= search_range) {
+    std::size_t path_index = FindCorridorNode(start);
+
+    if (path_index != kNotOnPath) return path_index;
+  }
+
+  return SearchNearestNode(start);
+}
+
+std::size_t PathNodeSearch::FindCorridorNode(const Vector2f& start) {
+  MapCoord start_coord = start;
+  std::size_t path_index = FindPathIndex(start_coord);
+
+  if (path_index != kNotOnPath) return path_index;
+
+  // The search takes its first step to all 8 neighbors and only moves to the sides after that, so the corridor holds
+  // the distances from the side steps and the first step is taken here.
+  u32 best_distance = kNoCorridorIndex;
+  u32 best_index = kNoCorridorIndex;
+  bool tied = false;
+
+  for (i16 y = -1; y <= 1; ++y) {
+    for (i16 x = -1; x <= 1; ++x) {
+      if (x == 0 && y == 0) continue;
+
+      MapCoord check(start_coord.x + x, start_coord.y + y);
+
+      if (!IsValidPosition(check)) continue;
+
+      CorridorCell* cell = GetCorridorCell(check);
+
+      if (cell == nullptr || cell->index == kNoCorridorIndex) continue;
+
+      u32 distance = cell->distance + 1;
+
+      if (distance < best_distance) {
+        best_distance = distance;
+        best_index = cell->index;
+        tied = cell->tied;
+      } else if (distance == best_distance) {
+        tied = tied || cell->tied || cell->index != best_index;
+      }
+    }
+  }
+
+  // Nothing on the path is in range, which is where the search gives up too.
+  if (best_index == kNoCorridorIndex || best_distance > search_range) {
+    return FindNearestNodeByDistance(start);
+  }
+
+  if (tied) return kNotOnPath;
+
+  return best_index;
+}
+
+std::size_t PathNodeSearch::SearchNearestNode(const Vector2f& start) {
   auto& registry = bot.GetRegions();
 
   MapCoord start_coord = start;
@@ -320,8 +1200,8 @@ size_t PathNodeSearch::FindNearestNodeBFS(const Vector2f& start) {
   queue.Clear();
   queue.Push(VisitState(start_coord, 0.0f));
 
-  visited.reset();
-  visited[start_coord.y * 1024 + start_coord.x] = 1;
+  visit_generation = NextGeneration(visit_generation, visit_marks);
+  MarkVisited(start_coord);
 
   // Loop over full neighbor set to improve traversable tile lookups.
   // This isn't done on every iteration for performance. It would have to check a bunch of tiles that were already
@@ -334,9 +1214,9 @@ size_t PathNodeSearch::FindNearestNodeBFS(const Vector2f& start) {
 
       if (!IsValidPosition(Vector2f(check.x, check.y))) continue;
 
-      if (!visited[check.y * 1024 + check.x] && !registry.IsEdge(check)) {
+      if (!IsVisited(check) && !registry.IsEdge(check)) {
         queue.Push(VisitState(check, 1.0f));
-        visited[check.y * 1024 + check.x] = true;
+        MarkVisited(check);
       }
     }
   }
@@ -352,23 +1232,16 @@ size_t PathNodeSearch::FindNearestNodeBFS(const Vector2f& start) {
 
     if (state.distance > search_range) continue;
 
-    // Check if the current tile is within the path set and return that index if it is.
-    if (path_set[coord.y * 1024 + coord.x]) {
-      for (size_t i = 0; i < path.size(); ++i) {
-        MapCoord check = path[i];
+    // Check if the current tile is on the path and return its index if it is.
+    std::size_t path_index = FindPathIndex(coord);
 
-        if (check == coord) {
+    if (path_index != kNotOnPath) {
 #if DEBUG_RENDER_PATHNODESEARCH
-          Vector2f debug_pos = Vector2f(check.x, check.y);
-          RenderWorldBox(bot.GetGame().GetPosition(), debug_pos - Vector2f(1, 1), debug_pos + Vector2f(1, 1),
-                         RGB(0, 255, 0));
+      Vector2f debug_pos = Vector2f(coord.x, coord.y);
+      RenderWorldBox(bot.GetGame().GetPosition(), debug_pos - Vector2f(1, 1), debug_pos + Vector2f(1, 1),
+                     RGB(0, 255, 0));
 #endif
-          return i;
-        }
-      }
-
-      // Something broke if it got here. The coord in the path set should always be found.
-      break;
+      return path_index;
     }
 
     const MapCoord west(coord.x - 1, coord.y);
@@ -378,24 +1251,24 @@ size_t PathNodeSearch::FindNearestNodeBFS(const Vector2f& start) {
 
     // Check if each neighbor tile was visited and push it into the queue if it wasn't.
 
-    if (IsValidPosition(Vector2f(west.x, west.y)) && !visited[west.y * 1024 + west.x] && !registry.IsEdge(west)) {
+    if (IsValidPosition(Vector2f(west.x, west.y)) && !IsVisited(west) && !registry.IsEdge(west)) {
       queue.Push(VisitState(west, state.distance + 1.0f));
-      visited[west.y * 1024 + west.x] = true;
+      MarkVisited(west);
     }
 
-    if (IsValidPosition(Vector2f(east.x, east.y)) && !visited[east.y * 1024 + east.x] && !registry.IsEdge(east)) {
+    if (IsValidPosition(Vector2f(east.x, east.y)) && !IsVisited(east) && !registry.IsEdge(east)) {
       queue.Push(VisitState(east, state.distance + 1.0f));
-      visited[east.y * 1024 + east.x] = true;
+      MarkVisited(east);
     }
 
-    if (IsValidPosition(Vector2f(north.x, north.y)) && !visited[north.y * 1024 + north.x] && !registry.IsEdge(north)) {
+    if (IsValidPosition(Vector2f(north.x, north.y)) && !IsVisited(north) && !registry.IsEdge(north)) {
       queue.Push(VisitState(north, state.distance + 1.0f));
-      visited[north.y * 1024 + north.x] = true;
+      MarkVisited(north);
     }
 
-    if (IsValidPosition(Vector2f(south.x, south.y)) && !visited[south.y * 1024 + south.x] && !registry.IsEdge(south)) {
+    if (IsValidPosition(Vector2f(south.x, south.y)) && !IsVisited(south) && !registry.IsEdge(south)) {
       queue.Push(VisitState(south, state.distance + 1.0f));
-      visited[south.y * 1024 + south.x] = true;
+      MarkVisited(south);
     }
   }
 
@@ -407,8 +1280,8 @@ std::size_t PathNodeSearch::FindNearestNodeByDistance(const Vector2f& position)
   float closest_distance_sq = std::numeric_limits<float>::max();
   std::size_t path_index = 0;
 
-  for (std::size_t i = 0; i < path.size(); i++) {
-    float distance_sq = position.DistanceSq(path[i]);
+  for (std::size_t i = 0; i < path->size(); i++) {
+    float distance_sq = position.DistanceSq((*path)[i]);
 
     if (closest_distance_sq > distance_sq) {
       path_index = i;
@@ -440,36 +1313,56 @@ Vector2f PathNodeSearch::FindRearLOSNode(Bot& bot, Vector2f position, std::size_
 // of the basees barrier.
 Vector2f PathNodeSearch::FindLOSNode(Bot& bot, Vector2f position, std::size_t index, float radius, bool count_down) {
   // this function should never be used on an empty path so this return is useless if it ever happens
-    if (path.empty()) return position;
-    
+    if (path == nullptr || path->empty()) return position;
+
+  // The walk is only done once for each position, node and radius.
+  LOSEntry& entry = GetLOSEntry(position, index, radius);
+  u32& end = count_down ? entry.low : entry.high;
+
+  if (end == kUnknownLOSIndex) {
+    end = (u32)FindLOSIndex(bot, position, index, radius, count_down);
+  }
+
+  Vector2f final_pos = (*path)[end];
+#if DEBUG_RENDER_PATHNODESEARCH
+  RenderWorldBox(bot.GetGame().GetPosition(), final_pos - Vector2f(1, 1), final_pos + Vector2f(1, 1), RGB(0, 0, 255));
+#endif
+  return final_pos;
+}
+
+std::size_t PathNodeSearch::FindLOSIndex(Bot& bot, Vector2f position, std::size_t index, float radius,
+                                         bool count_down) const {
   // return this if the loop fails its pretest (probably in a corner where it can't see any path nodes)
-  Vector2f final_pos = path[index];
+  std::size_t final_index = index;
   // count_down is used to determine which direction to look in
   if (count_down) {
-    for (std::size_t i = index; i >= 0; i--) {
-      Vector2f current = path[i];
-
-      if (!RadiusEdgeRayCastHit(bot, position, current, radius)) {
-        final_pos = current;
+    for (std::size_t i = index + 1; i-- > 0;) {
+      if (!RadiusEdgeRayCastHit(bot, position, (*path)[i], radius)) {
+        final_index = i;
       } else {
         break;
       }
     }
   } else {
-    for (std::size_t i = index; i < path.size(); i++) {
-      Vector2f current = path[i];
-
-      if (!RadiusEdgeRayCastHit(bot, position, current, radius)) {
-        final_pos = current;
+    for (std::size_t i = index; i < path->size(); i++) {
+      if (!RadiusEdgeRayCastHit(bot, position, (*path)[i], radius)) {
+        final_index = i;
       } else {
         break;
       }
     }
   }
-#if DEBUG_RENDER_PATHNODESEARCH
-  RenderWorldBox(bot.GetGame().GetPosition(), final_pos - Vector2f(1, 1), final_pos + Vector2f(1, 1), RGB(0, 0, 255));
-#endif
-  return final_pos;
+
+  return final_index;
+}
+
+void PathNodeSearch::ClearMapData() {
+  los_caches.clear();
+
+  // The path didn't move, so the box stays and the blocks are filled again from the new tiles when they're read.
+  for (std::vector<CorridorCell>& block : corridor_blocks) {
+    block.clear();
+  }
 }
 
 float PathNodeSearch::GetPathDistance(const Vector2f& pos1, const Vector2f& pos2) {
@@ -479,19 +1372,276 @@ float PathNodeSearch::GetPathDistance(const Vector2f& pos1, const Vector2f& pos2
   return GetPathDistance(first_index, second_index);
 }
 
-  float PathNodeSearch::GetPathDistance(std::size_t index1, std::size_t index2) {
-    if (index1 == index2) return 0.0f;
+std::vector<float> PathNodeSearch::CreateArcLengths(const std::vector<Vector2f>& path) {
+  std::vector<float> lengths(path.size(), 0.0f);
 
-    float distance = 0.0f;
+  for (std::size_t i = 1; i < path.size(); ++i) {
+    lengths[i] = lengths[i - 1] + path[i - 1].Distance(path[i]);
+  }
+
+  return lengths;
+}
+
+void PathNodeSearch::SetPath(const std::vector<Vector2f>& path) {
+  arc_lengths = CreateArcLengths(path);
+  SetPath(path, arc_lengths);
+}
+
+void PathNodeSearch::SetPath(const std::vector<Vector2f>& path, const std::vector<float>& lengths) {
+  this->path = &path;
+  this->lengths = &lengths;
 
-    size_t start = std::min(index1, index2);
-    size_t end = std::max(index1, index2);
+  corridor_blocks.clear();
+  corridor_range = 0;
+  los_caches.clear();
 
-    for (size_t i = start; i < end; i++) {
-      distance += path[i].Distance(path[i + 1]);
+  // Only the tiles of the old path are cleared so binding doesn't depend on the map size.
+  for (const PathIndexEntry& entry : path_indices) {
+    if (entry.tile != kEmptyTile) {
+      path_bits[entry.tile / 64] = 0;
     }
-    return distance;
   }
 
+  // Keep the table at most half full so probes stay short.
+  std::size_t capacity = 16;
+  path_index_shift = 28;
+
+  while (capacity < path.size() * 2) {
+    capacity *= 2;
+    --path_index_shift;
+  }
+
+  path_indices.assign(capacity, PathIndexEntry());
+  path_index_mask = (u32)(capacity - 1);
+
+  for (std::size_t i = 0; i < path.size(); ++i) {
+    MapCoord coord = path[i];
+    u32 tile = coord.y * 1024 + coord.x;
+    u32 slot = GetSlot(tile);
+
+    while (path_indices[slot].tile != kEmptyTile && path_indices[slot].tile != tile) {
+      slot = (slot + 1) & path_index_mask;
+    }
+
+    // Paths can cross the same tile more than once, so only the first index is kept like the old linear scan did.
+    if (path_indices[slot].tile == kEmptyTile) {
+      path_indices[slot].tile = tile;
+      path_indices[slot].index = (u32)i;
+      path_bits[tile / 64] |= 1ULL << (tile % 64);
+    }
+  }
+}
+
+std::size_t PathNodeSearch::FindPathIndex(const MapCoord& coord) const {
+  u32 tile = coord.y * 1024 + coord.x;
+
+  if (!(path_bits[tile / 64] & (1ULL << (tile % 64)))) return kNotOnPath;
+
+  u32 slot = GetSlot(tile);
+
+  while (path_indices[slot].tile != kEmptyTile) {
+    if (path_indices[slot].tile == tile) return path_indices[slot].index;
+
+    slot = (slot + 1) & path_index_mask;
+  }
+
+  return kNotOnPath;
+}
+
+void PathNodeSearch::BuildCorridor() {
+  corridor_blocks.clear();
+  corridor_range = 0;
+
+  if (path == nullptr || path->empty() || search_range == 0) return;
+
+  int range = (int)search_range;
+  int min_x = 1023;
+  int min_y = 1023;
+  int max_x = 0;
+  int max_y = 0;
+
+  for (MapCoord coord : *path) {
+    min_x = std::min(min_x, (int)coord.x);
+    min_y = std::min(min_y, (int)coord.y);
+    max_x = std::max(max_x, (int)coord.x);
+    max_y = std::max(max_y, (int)coord.y);
+  }
+
+  min_x = std::max(min_x - range, 0);
+  min_y = std::max(min_y - range, 0);
+  max_x = std::min(max_x + range, 1023);
+  max_y = std::min(max_y + range, 1023);
+
+  corridor_min = MapCoord(min_x, min_y);
+  corridor_width = (u16)(max_x - min_x + 1);
+  corridor_height = (u16)(max_y - min_y + 1);
+  corridor_blocks_wide = (corridor_width + kCorridorBlockSize - 1) / kCorridorBlockSize;
+  int blocks_high = (corridor_height + kCorridorBlockSize - 1) / kCorridorBlockSize;
+
+  corridor_blocks.resize((size_t)corridor_blocks_wide * blocks_high);
+  corridor_range = search_range;
+}
+
+void PathNodeSearch::BuildCorridorBlock(std::size_t block_index) {
+  auto& registry = bot.GetRegions();
+  int range = (int)corridor_range;
+  int block_x = corridor_min.x + (int)(block_index % corridor_blocks_wide) * kCorridorBlockSize;
+  int block_y = corridor_min.y + (int)(block_index / corridor_blocks_wide) * kCorridorBlockSize;
+  int block_width = std::min<int>(kCorridorBlockSize, corridor_min.x + corridor_width - block_x);
+  int block_height = std::min<int>(kCorridorBlockSize, corridor_min.y + corridor_height - block_y);
+
+  // A path tile that's in range of the block is at most the range away from it, and so is every tile between them.
+  int min_x = std::max<int>(block_x - range, corridor_min.x);
+  int min_y = std::max<int>(block_y - range, corridor_min.y);
+  int max_x = std::min<int>(block_x + block_width - 1 + range, corridor_min.x + corridor_width - 1);
+  int max_y = std::min<int>(block_y + block_height - 1 + range, corridor_min.y + corridor_height - 1);
+  int width = max_x - min_x + 1;
+
+  auto get_cell = [&](const MapCoord& coord) -> CorridorCell* {
+    if (coord.x < min_x || coord.y < min_y || coord.x > max_x || coord.y > max_y) return nullptr;
+
+    return &corridor_scratch[(size_t)(coord.y - min_y) * width + (coord.x - min_x)];
+  };
+
+  corridor_scratch.assign((size_t)width * (max_y - min_y + 1), CorridorCell());
+  corridor_pending.clear();
+
+  std::size_t next = 0;
+
+  // A search only moves through tiles that aren't edges and only finds the path tiles that aren't edges, so those are
+  // the seeds. Edges don't get a cell, and FindCorridorNode takes the first step from them like the search does.
+  for (std::size_t i = 0; i < path->size(); ++i) {
+    MapCoord coord = (*path)[i];
+    CorridorCell* cell = get_cell(coord);
+
+    if (cell == nullptr || cell->index != kNoCorridorIndex) continue;
+    if (!IsValidPosition(coord) || registry.IsEdge(coord)) continue;
+
+    cell->index = (u32)i;
+    cell->distance = 0;
+    corridor_pending.push_back(coord);
+  }
+
+  // Every cell at one distance is expanded before the next distance, so a cell has heard from every neighbor that is
+  // one step closer by the time it's expanded.
+  while (next < corridor_pending.size()) {
+    MapCoord coord = corridor_pending[next++];
+    CorridorCell cell = *get_cell(coord);
+
+    if (cell.distance >= corridor_range) continue;
+
+    // The same side steps in the same order as the search.
+    const MapCoord neighbors[] = {MapCoord(coord.x - 1, coord.y), MapCoord(coord.x + 1, coord.y),
+                                  MapCoord(coord.x, coord.y - 1), MapCoord(coord.x, coord.y + 1)};
+
+    for (const MapCoord& neighbor : neighbors) {
+      if (!IsValidPosition(neighbor) || registry.IsEdge(neighbor)) continue;
+
+      CorridorCell* neighbor_cell = get_cell(neighbor);
+
+      if (neighbor_cell == nullptr) continue;
+
+      if (neighbor_cell->index == kNoCorridorIndex) {
+        neighbor_cell->index = cell.index;
+        neighbor_cell->distance = cell.distance + 1;
+        neighbor_cell->tied = cell.tied;
+        corridor_pending.push_back(neighbor);
+      } else if (neighbor_cell->distance == cell.distance + 1) {
+        neighbor_cell->tied = neighbor_cell->tied || cell.tied || neighbor_cell->index != cell.index;
+      }
+    }
+  }
+
+  std::vector<CorridorCell>& block = corridor_blocks[block_index];
+
+  block.resize((size_t)kCorridorBlockSize * kCorridorBlockSize);
+
+  for (int y = 0; y < block_height; ++y) {
+    for (int x = 0; x < block_width; ++x) {
+      block[(size_t)y * kCorridorBlockSize + x] = *get_cell(MapCoord(block_x + x, block_y + y));
+    }
+  }
+
+#ifndef NDEBUG
+  // Check a few tiles inside the block against the search that it replaces. Their neighbors are in the block too,
+  // so the check doesn't fill other blocks.
+  for (int i = 0; i < 8 && block_width >= 3 && block_height >= 3; ++i) {
+    int x = block_x + 1 + (block_width - 2) * i / 8;
+    int y = block_y + 1 + (block_height - 2) * ((i * 3) % 8) / 8;
+    Vector2f position((float)x, (float)y);
+    std::size_t corridor_index = FindCorridorNode(position);
+
+    assert(corridor_index == kNotOnPath || corridor_index == SearchNearestNode(position));
+  }
+#endif
+}
+
+PathNodeSearch::LOSEntry& PathNodeSearch::GetLOSEntry(const Vector2f& position, std::size_t index, float radius) {
+  LOSCache* cache = nullptr;
+
+  for (LOSCache& check : los_caches) {
+    if (check.radius == radius) {
+      cache = &check;
+      break;
+    }
+  }
+
+  if (cache == nullptr) {
+    los_caches.push_back(LOSCache());
+    cache = &los_caches.back();
+    cache->radius = radius;
+    cache->entries.resize(kLOSCacheSize);
+  }
+
+  u32 x_bits = 0;
+  u32 y_bits = 0;
+
+  memcpy(&x_bits, &position.x, sizeof(x_bits));
+  memcpy(&y_bits, &position.y, sizeof(y_bits));
+
+  u32 slot = (x_bits * 2654435761u + y_bits * 2246822519u + (u32)index * 3266489917u) >> kLOSCacheShift;
+  LOSEntry& entry = cache->entries[slot];
+
+  if (!(entry.position == position) || entry.index != (u32)index) {
+    entry = LOSEntry();
+    entry.position = position;
+    entry.index = (u32)index;
+  }
+
+  return entry;
+}
+
+PathNodeSearch::CorridorCell* PathNodeSearch::GetCorridorCell(const MapCoord& coord) {
+  int x = (int)coord.x - corridor_min.x;
+  int y = (int)coord.y - corridor_min.y;
+
+  if (x < 0 || y < 0 || x >= corridor_width || y >= corridor_height) return nullptr;
+
+  std::size_t block_index = (size_t)(y / kCorridorBlockSize) * corridor_blocks_wide + x / kCorridorBlockSize;
+
+  if (corridor_blocks[block_index].empty()) {
+    BuildCorridorBlock(block_index);
+  }
+
+  return &corridor_blocks[block_index][(size_t)(y % kCorridorBlockSize) * kCorridorBlockSize + x % kCorridorBlockSize];
+}
+
+void PathNodeSearch::SetSearchRange(size_t range) {
+  if (GetQueueSize(range) > queue.max_size) {
+    queue.Resize(GetQueueSize(range));
+  }
+
+  search_range = range;
+}
+
+u16 PathNodeSearch::NextGeneration(u16 generation, std::vector<u16>& marks) {
+  if (++generation == 0) {
+    std::fill(marks.begin(), marks.end(), 0);
+    generation = 1;
+  }
+
+  return generation;
+}
+
 }  // namespace path
 }  // namespace marvin
@@ -1,83 +1,316 @@
 #pragma once
 
 #include <algorithm>
-#include <bitset>
+#include <cmath>
+#include <condition_variable>
 #include <memory>
-#include <unordered_set>
+#include <mutex>
 #include <vector>
 
 #include "../Vector2f.h"
+#include "ClusterGraph.h"
+#include "FlowField.h"
+#include "IncrementalPlanner.h"
 #include "NodeProcessor.h"
 #include "Path.h"
+#include "PathCache.h"
 
 namespace marvin {
 
 class Bot;
+class WorkerPool;
 
 namespace path {
 
-template <typename T, typename Compare, typename Container = std::vector<T>>
-
-class PriorityQueue {
+// Indexed 4-ary min heap of nodes ordered by f. Each node stores its slot in the heap, so a node that finds a
+// cheaper path can be moved up in place instead of being pushed again as a duplicate.
+class NodeHeap {
  public:
-  using const_iterator = typename Container::const_iterator;
-
-  const_iterator begin() const { return container_.cbegin(); }
-  const_iterator end() const { return container_.cend(); }
+  void Push(Node* node, float f) {
+    entries_.push_back(Entry(f, node));
+    node->heap_index = (u32)(entries_.size() - 1);
+    SiftUp(entries_.size() - 1);
+  }
 
-  void Push(T item) {
-    container_.push_back(item);
-    std::push_heap(container_.begin(), container_.end(), comparator_);
+  // Lowers the f value of a node that is already in the heap.
+  void Decrease(Node* node, float f) {
+    entries_[node->heap_index].f = f;
+    SiftUp(node->heap_index);
   }
 
-  T Pop() {
-    T item = container_.front();
-    std::pop_heap(container_.begin(), container_.end(), comparator_);
-    container_.pop_back();
-    return item;
+  Node* Pop() {
+    Node* node = entries_[0].node;
+    node->heap_index = Node::kInvalidHeapIndex;
+
+    Entry last = entries_.back();
+    entries_.pop_back();
+
+    if (!entries_.empty()) {
+      entries_[0] = last;
+      last.node->heap_index = 0;
+      SiftDown(0);
+    }
+
+    return node;
   }
 
-  // sort from highest at beginning to lowest at end
-  void Update() { std::make_heap(container_.begin(), container_.end(), comparator_); }
+  bool Contains(const Node* node) const { return node->heap_index != Node::kInvalidHeapIndex; }
+
+  void Clear() {
+    for (Entry& entry : entries_) {
+      entry.node->heap_index = Node::kInvalidHeapIndex;
+    }
+
+    entries_.clear();
+  }
 
-  void Clear() { container_.clear(); }
-  std::size_t Size() const { return container_.size(); }
-  bool Empty() const { return container_.empty(); }
+  std::size_t Size() const { return entries_.size(); }
+  bool Empty() const { return entries_.empty(); }
 
  private:
-  Container container_;
-  Compare comparator_;
+  static constexpr std::size_t kArity = 4;
+
+  struct Entry {
+    float f;
+    Node* node;
+
+    Entry(float f, Node* node) : f(f), node(node) {}
+  };
+
+  void SiftUp(std::size_t index) {
+    Entry entry = entries_[index];
+
+    while (index > 0) {
+      std::size_t parent = (index - 1) / kArity;
+
+      if (entries_[parent].f <= entry.f) break;
+
+      Place(index, entries_[parent]);
+      index = parent;
+    }
+
+    Place(index, entry);
+  }
+
+  void SiftDown(std::size_t index) {
+    Entry entry = entries_[index];
+    std::size_t size = entries_.size();
+
+    while (true) {
+      std::size_t first_child = index * kArity + 1;
+
+      if (first_child >= size) break;
+
+      std::size_t last_child = std::min(first_child + kArity, size);
+      std::size_t best = first_child;
+
+      for (std::size_t child = first_child + 1; child < last_child; ++child) {
+        if (entries_[child].f < entries_[best].f) {
+          best = child;
+        }
+      }
+
+      if (entry.f <= entries_[best].f) break;
+
+      Place(index, entries_[best]);
+      index = best;
+    }
+
+    Place(index, entry);
+  }
+
+  inline void Place(std::size_t index, const Entry& entry) {
+    entries_[index] = entry;
+    entry.node->heap_index = (u32)index;
+  }
+
+  std::vector<Entry> entries_;
 };
 
+enum class SearchMode {
+  // Expands every tile one at a time.
+  AStar,
+  // Jumps across the uniform open areas and only expands tiles one at a time near walls.
+  JumpPoint,
+  // Searches the cluster graph for long paths and only expands tiles for the first few clusters.
+  Hierarchical,
+  // Keeps the search tree between searches and repairs it when the goal or the hazards change. Used for chasing
+  // targets that move every frame.
+  Incremental,
+  // Reads the path from a flow field that is built once for the goal and shared by every search to it. Used for
+  // fixed destinations that are pathed to from many places.
+  FlowField
+};
+
+struct SearchStats {
+  SearchMode mode = SearchMode::AStar;
+  // The number of nodes that were popped from the open set and had their edges searched.
+  std::size_t nodes_expanded = 0;
+  // Open set operations. Updates are nodes that found a cheaper path while already in the open set.
+  std::size_t heap_pushes = 0;
+  std::size_t heap_pops = 0;
+  std::size_t heap_updates = 0;
+  // Set when the path was taken from the path cache instead of being searched.
+  bool cache_hit = false;
+};
+
+// Limits the work that a single call of a sliced search can do. A limit of zero isn't checked.
+struct SearchBudget {
+  std::size_t nodes = 0;
+  u64 microseconds = 0;
+
+  SearchBudget() {}
+  SearchBudget(std::size_t nodes, u64 microseconds) : nodes(nodes), microseconds(microseconds) {}
+
+  bool IsUnlimited() const { return nodes == 0 && microseconds == 0; }
+};
+
+enum class SearchStatus { Complete, InProgress, Failed };
+
 struct Pathfinder {
  public:
   Pathfinder(std::unique_ptr<NodeProcessor> processor, RegionRegistry& regions);
+  // Waits for the cluster build that is running since the workers read the processor.
+  ~Pathfinder();
   std::vector<Vector2f> FindPath(const Map& map, const std::vector<Vector2f>& mines, const Vector2f& from, const Vector2f& to,
-                                 float radius);
+                                 float radius, SearchMode mode = SearchMode::AStar);
+
+  // Finds the A* path from each point in from to the point at the same index in to by spreading the searches across
+  // the worker pool. Each thread searches with its own nodes and only reads the tile data, so the paths are the same
+  // as FindPath without mines. The paths are returned in the same order as the points.
+  std::vector<std::vector<Vector2f>> FindPaths(const Map& map, const std::vector<Vector2f>& from,
+                                               const std::vector<Vector2f>& to, float radius, WorkerPool& workers);
 
   const std::vector<Vector2f>& GetPath() { return path_; }
   void SetPath(std::vector<Vector2f> path) { path_ = path; }
 
+  // Stats from the last call to FindPath.
+  const SearchStats& GetSearchStats() const { return stats_; }
+  PathCache& GetPathCache() { return cache_; }
+  NodeProcessor& GetProcessor() { return *processor_; }
+  FlowFieldCache& GetFlowFields() { return flow_fields_; }
+  // Flow fields are built on the worker pool when one is set. Without one they're built during the search.
+  void SetWorkerPool(WorkerPool* workers) { workers_ = workers; }
+
+  // Removes the points that the ship can skip by moving in a straight line, so the path is reduced to the corners.
+  // CreatePath smooths every path it creates.
   std::vector<Vector2f> SmoothPath(Bot& bot, const std::vector<Vector2f>& path, float ship_radius);
 
-  std::vector<Vector2f> CreatePath(Bot& bot, Vector2f from, Vector2f to, float radius);
+  // Starts a search that can be spread across several calls so a long search doesn't stall a single frame.
+  // The path is set to the path to the expanded node closest to the goal while the search is in progress.
+  SearchStatus StartSlicedSearch(const Map& map, const std::vector<Vector2f>& mines, const Vector2f& from,
+                                 const Vector2f& to, float radius, SearchMode mode, const SearchBudget& budget,
+                                 std::vector<Vector2f>& path);
+  // Continues the last sliced search for up to the budget. The sliced search keeps its own nodes, so other searches
+  // can run in between. It only starts over when the map data changes.
+  SearchStatus ContinueSlicedSearch(const SearchBudget& budget, std::vector<Vector2f>& path);
+
+  std::vector<Vector2f> CreatePath(Bot& bot, Vector2f from, Vector2f to, float radius,
+                                   SearchMode mode = SearchMode::AStar);
+  // Sets the budget that CreatePath uses for each call. CreatePath keeps the old path while a search that went
+  // over the budget is still in progress.
+  void SetSearchBudget(const SearchBudget& budget) { search_budget_ = budget; }
 
   void CreateMapWeights(const Map& map);
+  // Distance to the closest wall by scanning the square around the tile. CreateMapWeights uses the distance field
+  // instead, so this is only used for the few tiles that UpdateTiles changes and as the reference for benchmarking.
+  static float GetWallDistance(const Map& map, u16 x, u16 y, u16 radius);
   void SetPathableNodes(const Map& map, float radius);
+  // Updates the weights, pathable flags, masks and clusters around the tiles that changed between solid and open.
+  // The caches that depend on the whole map are only dropped once for all of them.
+  void UpdateTiles(const Map& map, const std::vector<MapCoord>& tiles, float radius);
+  // Builds the cluster graph used by hierarchical searches. This needs to be called after the weights and pathable
+  // nodes are set. Hierarchical searches fall back to A* while the clusters were built for a different radius.
+  void CreateClusters(const Map& map);
+  // Builds the cluster graph on the workers from a copy of the tiles, so a ship change doesn't stall the frame. The
+  // old graph is kept until CollectClusters swaps in the new one.
+  void StartClusterBuild(const Map& map);
+  // Swaps in the cluster graph that the workers finished. This needs to be called every frame.
+  void CollectClusters();
+  // Saves and loads the data created by CreateMapWeights, SetPathableNodes and CreateClusters so it can be cached
+  // between runs.
+  void SaveMapData(CacheWriter& writer) const;
+  bool LoadMapData(const Map& map, CacheReader& reader);
   void DebugUpdate(const Vector2f& position);
 
  private:
-  float GetWallDistance(const Map& map, u16 x, u16 y, u16 radius);
-  struct NodeCompare {
-    bool operator()(const Node* lhs, const Node* rhs) const { return lhs->f > rhs->f; }
-  };
-
+  // Runs the search without going through the path cache.
+  std::vector<Vector2f> SearchPath(const Map& map, const std::vector<Vector2f>& mines, const Vector2f& from,
+                                   const Vector2f& to, float radius, SearchMode mode);
+  void PushStart(NodeHeap& openset, Node* start, Node* goal);
+  // Expands nodes until the goal is reached or the budget runs out. Returns false if the budget ran out first.
+  bool ExpandNodes(NodeHeap& openset, Node* start, Node* goal, SearchMode mode, const SearchBudget& budget);
+  // Runs the sliced search on its own nodes. ContinueSlicedSearch switches the processor to them around this.
+  SearchStatus ExpandSlicedSearch(const SearchBudget& budget, std::vector<Vector2f>& path);
+  std::vector<Vector2f> BuildPath(Node* start, Node* goal);
+  // Searches the cluster graph for the entrance that the tiles need to be searched to and the coarse entrances
+  // after it. Returns false if the whole path should be searched on the tiles.
+  bool FindRefinePoint(NodePoint start, NodePoint goal, NodePoint* refine_point, std::vector<Vector2f>& coarse_path);
+  PathCacheKey GetCacheKey(NodePoint start, NodePoint goal, float radius, const std::vector<Vector2f>& mines);
+  u32 GetOverlayHash(const std::vector<Vector2f>& mines);
+  // Sets the weight of an open tile from its distance to the closest wall.
+  void SetMapWeight(const Map& map, u16 x, u16 y, float distance);
+  std::vector<Vector2f> FindHierarchicalPath(const Map& map, const std::vector<Vector2f>& mines, const Vector2f& from,
+                                             const Vector2f& to, float radius, NodePoint start, NodePoint goal);
 
   std::vector<Vector2f> path_;
+  SearchStats stats_;
   std::unique_ptr<NodeProcessor> processor_;
+  std::unique_ptr<ClusterGraph> clusters_;
+  std::unique_ptr<IncrementalPlanner> planner_;
   RegionRegistry& regions_;
-  PriorityQueue<Node*, NodeCompare> openset_;
-  std::unordered_set<Node*> touched_nodes_;
+  NodeHeap openset_;
+  PathCache cache_;
+  FlowFieldCache flow_fields_;
+  WorkerPool* workers_ = nullptr;
+  // Increased whenever the weights or pathable nodes change so old cached paths aren't used.
+  u32 map_version_ = 0;
+  // The ship radius that the pathable nodes were last set for and the one that the clusters were built for.
+  // Hierarchical searches only use the clusters when the two match.
+  float pathable_radius_ = 0.0f;
+  float cluster_radius_ = -1.0f;
+
+  // Set when a cluster build is running, and when the tiles changed after it started. Only used by the owning thread.
+  bool building_clusters_ = false;
+  bool clusters_stale_ = false;
+  float cluster_build_radius_ = 0.0f;
+  const Map* cluster_build_map_ = nullptr;
+  // The graph that the workers finished and whether a build is running, guarded by the mutex.
+  std::unique_ptr<ClusterGraph> built_clusters_;
+  bool cluster_build_running_ = false;
+  std::mutex cluster_mutex_;
+  std::condition_variable cluster_done_;
+
+  struct SlicedSearch {
+    bool active = false;
+    // Set when the search needs to start over because it was just started or the map data changed.
+    bool interrupted = false;
+    // The stats of the sliced search so far, since other searches reset stats_ between calls.
+    SearchStats stats;
+
+    const Map* map = nullptr;
+    std::vector<Vector2f> mines;
+    Vector2f from;
+    Vector2f to;
+    float radius = 0.0f;
+    SearchMode mode = SearchMode::AStar;
+
+    // The tiles being searched between. Hierarchical searches only search the tiles to the refine point.
+    NodePoint start;
+    NodePoint goal;
+    std::vector<Vector2f> coarse_path;
+
+    Node* closest = nullptr;
+    float closest_distance = 0.0f;
+  };
+
+  SlicedSearch sliced_;
+  // Created with the first sliced search and kept for the next ones.
+  std::unique_ptr<NodeSet> sliced_nodes_;
+  NodeHeap sliced_openset_;
+  SearchBudget search_budget_;
+  // Set when path_ is the partial result of a search that is still in progress.
+  bool partial_path_ = false;
 };
 
 template <typename T>
@@ -91,6 +324,14 @@ struct CircularQueue {
   CircularQueue(size_t max_size) : max_size(max_size) { buffer = new T[max_size]; }
   ~CircularQueue() { delete[] buffer; }
 
+  // Replaces the buffer with one of the new size. Anything in the queue is dropped.
+  void Resize(size_t size) {
+    delete[] buffer;
+    buffer = new T[size];
+    max_size = size;
+    Clear();
+  }
+
   inline void Clear() {
     write_index = read_index = 0;
     count = 0;
@@ -148,6 +389,9 @@ struct CircularQueue {
   }
 };
 
+// Finds the nodes of a path that positions are closest to. The search keeps its scratch memory between calls and
+// marks the visited tiles with a generation instead of clearing them, so a query only costs the tiles it searches.
+// The bot keeps one that is bound to the current base path.
 struct PathNodeSearch {
   struct VisitState {
     MapCoord coord;
@@ -159,17 +403,102 @@ struct PathNodeSearch {
 
   Bot& bot;
   CircularQueue<VisitState> queue;
-  std::bitset<1024 * 1024> visited;
-  std::bitset<1024 * 1024> path_set;
+  // A tile is visited in the current search when its mark equals the visit generation.
+  std::vector<u16> visit_marks;
+  u16 visit_generation = 0;
+  // One bit for each tile on the bound path so the tiles that aren't on it are rejected without probing the table.
+  std::vector<u64> path_bits;
+  // Open addressing table from the packed tile index to the first index of the bound path on that tile.
+  struct PathIndexEntry {
+    u32 tile = kEmptyTile;
+    u32 index = 0;
+  };
+  std::vector<PathIndexEntry> path_indices;
+  u32 path_index_mask = 0;
+  // The table size is a power of two, so the top bits of the hash are used as the slot.
+  u32 path_index_shift = 0;
+  // The nearest path index and search distance for each tile in a box around the bound path. Tied is set when more
+  // than one path index is that distance away, since the search would pick between them by its visit order.
+  struct CorridorCell {
+    u32 index = kNoCorridorIndex;
+    u32 distance = 0;
+    bool tied = false;
+  };
+  // The box is split into square blocks that are filled the first time a query reads them. Blocks that haven't been
+  // filled are empty.
+  std::vector<std::vector<CorridorCell>> corridor_blocks;
+  MapCoord corridor_min = MapCoord(0, 0);
+  u16 corridor_width = 0;
+  u16 corridor_height = 0;
+  u16 corridor_blocks_wide = 0;
+  // Scratch memory for filling a block.
+  std::vector<CorridorCell> corridor_scratch;
+  std::vector<MapCoord> corridor_pending;
+  // The search range that the corridor was built with. Zero when there's no corridor.
+  size_t corridor_range = 0;
+  // The furthest nodes that can be seen from a position, walking from its nearest node, before the first node that
+  // can't. The same position and node are looked up by several nodes in a tick, so each walk is kept until another
+  // position and node use the slot. There's one table for each radius.
+  struct LOSEntry {
+    Vector2f position;
+    u32 index = kEmptyTile;
+    u32 low = kUnknownLOSIndex;
+    u32 high = kUnknownLOSIndex;
+  };
+  struct LOSCache {
+    float radius;
+    std::vector<LOSEntry> entries;
+  };
+  std::vector<LOSCache> los_caches;
   size_t search_range;
-  const std::vector<Vector2f>& path;
+  const std::vector<Vector2f>* path = nullptr;
+  // Only used when the lengths aren't passed in.
+  std::vector<float> arc_lengths;
+  // The distance along the path from the first node to each node.
+  const std::vector<float>* lengths = nullptr;
+
+  static std::unique_ptr<PathNodeSearch> Create(Bot& bot, size_t search_range) {
+    return std::unique_ptr<PathNodeSearch>(new PathNodeSearch(bot, search_range));
+  }
 
   static std::unique_ptr<PathNodeSearch> Create(Bot& bot, const std::vector<Vector2f>& path,
                                                 size_t search_range) {
-    return std::unique_ptr<PathNodeSearch>(new PathNodeSearch(bot, path, search_range));
+    auto search = Create(bot, search_range);
+    search->SetPath(path);
+    return search;
   }
 
+  // Uses lengths that were already created for the path with CreateArcLengths.
+  static std::unique_ptr<PathNodeSearch> Create(Bot& bot, const std::vector<Vector2f>& path,
+                                                const std::vector<float>& lengths, size_t search_range) {
+    auto search = Create(bot, search_range);
+    search->SetPath(path, lengths);
+    return search;
+  }
+
+  static std::vector<float> CreateArcLengths(const std::vector<Vector2f>& path);
+
+  // Binds the search to a path. The path and lengths need to outlive the binding.
+  void SetPath(const std::vector<Vector2f>& path);
+  void SetPath(const std::vector<Vector2f>& path, const std::vector<float>& lengths);
+  const std::vector<Vector2f>& GetPath() const { return *path; }
+
+  // Sets how many tiles away from the start FindNearestNodeBFS searches for the path.
+  void SetSearchRange(size_t range);
+  size_t GetSearchRange() const { return search_range; }
+
+  // Sets up a corridor up to the search range around the path, so FindNearestNodeBFS can read the nearest node of
+  // any tile in it instead of searching. Each block of the corridor is filled by searching outward from the nearby
+  // path tiles at once the first time it's read. The steps are the same as the search, so the result is the same
+  // except where several nodes are equally near, which still searches. Binding a path drops the corridor.
+  void BuildCorridor();
+  size_t GetCorridorRange() const { return corridor_range; }
+
   size_t FindNearestNodeBFS(const Vector2f& start);
+  // Returns kNotOnPath if the tile isn't on the bound path.
+  std::size_t FindPathIndex(const MapCoord& coord) const;
+
+  static constexpr std::size_t kNotOnPath = ~(std::size_t)0;
 
   std::size_t FindNearestNodeByDistance(const Vector2f& position) const;
 
@@ -177,17 +506,55 @@ struct PathNodeSearch {
  Vector2f FindForwardLOSNode(Bot& bot, Vector2f position, std::size_t index, float radius, bool high_side);
  Vector2f FindRearLOSNode(Bot& bot, Vector2f position, std::size_t index, float radius, bool high_side);
 
+  // Drops the corridor and line of sight results that were built from the tiles. This needs to be called when the
+  // map changes while the path stays bound.
+  void ClearMapData();
+
   float GetPathDistance(const Vector2f& pos1, const Vector2f& pos2);
-  float GetPathDistance(std::size_t index1, std::size_t index2);
+  float GetPathDistance(std::size_t index1, std::size_t index2) const {
+    if (index1 == index2) return 0.0f;
+    return std::abs((*lengths)[index2] - (*lengths)[index1]);
+  }
 
  private:
   // Private constructor to ensure it's allocated on the heap.
-  PathNodeSearch(Bot& bot, const std::vector<Vector2f>& path, size_t search_range)
-      : bot(bot), path(path), search_range(search_range), queue(GetQueueSize(search_range)) {
-    for (MapCoord coord : path) {
-      path_set[coord.y * 1024 + coord.x] = 1;
-    }
-  }
+  PathNodeSearch(Bot& bot, size_t search_range)
+      : bot(bot),
+        queue(GetQueueSize(search_range)),
+        visit_marks(1024 * 1024, 0),
+        path_bits(1024 * 1024 / 64, 0),
+        search_range(search_range) {}
+
+  void MarkVisited(const MapCoord& coord) { visit_marks[coord.y * 1024 + coord.x] = visit_generation; }
+  bool IsVisited(const MapCoord& coord) const { return visit_marks[coord.y * 1024 + coord.x] == visit_generation; }
+
+  static constexpr u32 kEmptyTile = 0xFFFFFFFF;
+  static constexpr u32 kNoCorridorIndex = 0xFFFFFFFF;
+
+  static constexpr int kCorridorBlockSize = 64;
+
+  // Returns nullptr if the tile is outside of the corridor box. Fills the tile's block if it's empty.
+  CorridorCell* GetCorridorCell(const MapCoord& coord);
+  void BuildCorridorBlock(std::size_t block_index);
+  // Reads the nearest node from the corridor. Returns kNotOnPath when several nodes are equally near and the search
+  // needs to pick one.
+  std::size_t FindCorridorNode(const Vector2f& start);
+  // The breadth first search that the corridor replaces.
+  std::size_t SearchNearestNode(const Vector2f& start);
+  static constexpr u32 kUnknownLOSIndex = 0xFFFFFFFF;
+  // The top bits of the hash are used as the slot like the path index table.
+  static constexpr u32 kLOSCacheShift = 22;
+  static constexpr std::size_t kLOSCacheSize = (std::size_t)1 << (32 - kLOSCacheShift);
+
+  // Returns the slot for the tile and node, which is reset if it held another pair.
+  LOSEntry& GetLOSEntry(const Vector2f& position, std::size_t index, float radius);
+  // Walks from the node at index until a node can't be seen from the position.
+  std::size_t FindLOSIndex(Bot& bot, Vector2f position, std::size_t index, float radius, bool count_down) const;
+
+  inline u32 GetSlot(u32 tile) const { return (tile * 2654435761u) >> path_index_shift; }
+
+  // Returns the next generation and clears the marks if it wrapped around so old marks can't match it.
+  static u16 NextGeneration(u16 generation, std::vector<u16>& marks);
 
   static inline size_t GetQueueSize(size_t search_range) {
     size_t d = (search_range * 2);
@@ -759,8 +759,8 @@ void DevaAttachNode::SetAttachTarget(behavior::ExecuteContext& ctx) {
   auto& bb = ctx.blackboard;
   auto& pf = ctx.bot->GetPathfinder();
 
-  std::vector<Vector2f> path = ctx.bot->GetBasePath();
-  auto ns = path::PathNodeSearch::Create(*ctx.bot, path, 30);
+  const std::vector<Vector2f>& path = ctx.bot->GetBasePath();
+  path::PathNodeSearch& ns = ctx.bot->GetBasePathSearch(30);
 
   std::vector<Player> team_list = bb.ValueOr<std::vector<Player>>("TeamList", std::vector<Player>());
   std::vector<Player> combined_list = bb.ValueOr<std::vector<Player>>("CombinedList", std::vector<Player>());
@@ -795,8 +795,8 @@ void DevaAttachNode::SetAttachTarget(behavior::ExecuteContext& ctx) {
     if (player_in_base) {
       // if (!player_in_center && IsValidPosition(player.position) && player.ship < 8) {
 
-      float distance_to_team = ns->GetPathDistance(player.position, bb.ValueOr<Vector2f>("TeamSafe", Vector2f()));
-      float distance_to_enemy = ns->GetPathDistance(player.position, bb.ValueOr<Vector2f>("EnemySafe", Vector2f()));
+      float distance_to_team = ns.GetPathDistance(player.position, bb.ValueOr<Vector2f>("TeamSafe", Vector2f()));
+      float distance_to_enemy = ns.GetPathDistance(player.position, bb.ValueOr<Vector2f>("EnemySafe", Vector2f()));
 
       if (player.frequency == game.GetPlayer().frequency) {
         // float distance_to_team = ctx.deva->PathLength(player.position, ctx.deva->GetTeamSafe());
@@ -855,7 +855,7 @@ void DevaAttachNode::SetAttachTarget(behavior::ExecuteContext& ctx) {
 
       float distance_to_enemy_position = 0.0f;
 
-      distance_to_enemy_position = ns->GetPathDistance(player.position, closest_enemy_to_team);
+      distance_to_enemy_position = ns.GetPathDistance(player.position, closest_enemy_to_team);
 
       // get the closest player
       if (distance_to_enemy_position < closest_distance) {
@@ -946,7 +946,10 @@ behavior::ExecuteResult DevaPatrolBaseNode::Execute(behavior::ExecuteContext& ct
 
   Vector2f enemy_safe = bb.ValueOr<Vector2f>("EnemySafe", Vector2f());
 
-  ctx.bot->GetPathfinder().CreatePath(*ctx.bot, game.GetPosition(), enemy_safe, game.GetShipSettings().GetRadius());
+  // The enemy safe doesn't move while the base is being played, so every patrol reads from the same flow field.
+  // The field is built around the enemy mines, and the patrol searches with A* while it's built for new mines.
+  ctx.bot->GetPathfinder().CreatePath(*ctx.bot, game.GetPosition(), enemy_safe, game.GetShipSettings().GetRadius(),
+                                      path::SearchMode::FlowField);
 
   g_RenderState.RenderDebugText("  DevaPatrolBaseNode: %llu", timer.GetElapsedTime());
   return behavior::ExecuteResult::Success;
@@ -425,7 +425,9 @@ behavior::ExecuteResult PatrolNode::Execute(behavior::ExecuteContext& ctx) {
     to = nodes.at(index);
   }
 
-  path = ctx.bot->GetPathfinder().CreatePath(*ctx.bot, from, to, game.GetShipSettings().GetRadius());
+  // The patrol crosses the open center, so jump point search skips most of the tiles that A* would expand.
+  path = ctx.bot->GetPathfinder().CreatePath(*ctx.bot, from, to, game.GetShipSettings().GetRadius(),
+                                             path::SearchMode::JumpPoint);
   ctx.blackboard.Set("path", path);
 
   g_RenderState.RenderDebugText("PatrolNode(Success): %llu", timer.GetElapsedTime());